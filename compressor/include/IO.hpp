@@ -2,25 +2,180 @@
 #define IO_HPP
 
 #include <cctype>
+#include <condition_variable>
+#include <deque>
+#include <exception>
 #include <fstream>
+#include <functional>
 #include <iosfwd>
 #include <iostream>
 #include <limits>
 #include <memory>
+#include <mutex>
 #include <sstream>
+#include <string_view>
+#include <thread>
 
 #include "Model.hpp"
 
+namespace Parallel {
+class ThreadPool;
+};
+
 namespace IO {
+// Read-only memory mapping of a whole regular file. Rows are parsed in place
+// as string_views instead of being copied out through std::getline.
+class MappedFile {
+ private:
+  const char* data_{nullptr};
+  size_t size_{0};
+  size_t skip_{0};
+
+  MappedFile(const char* data, size_t size);
+
+ public:
+  // Map 'fd' if it is a non-empty regular file; nullptr for pipes, terminals
+  // or platforms without mmap (callers then fall back to std::istream).
+  static std::unique_ptr<MappedFile> open(int fd);
+  ~MappedFile();
+
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  const char* data() const;
+  size_t size() const;
+  // File position the descriptor was at when mapped
+  size_t startOffset() const;
+
+  // Readahead hint for [offset, offset + len)
+  void prefetch(size_t offset, size_t len) const;
+};
+
+// Fills fixed-size batches of translated rows on a background thread, so
+// reading and parsing the input overlaps with compression. At most 'depth'
+// batches are read ahead of the consumer.
+class BatchReader {
+ public:
+  // Fill 'dst' with up to 'maxRows' rows; fewer rows means end of input
+  using FillFn = std::function<size_t(uint8_t* dst, size_t maxRows)>;
+
+  BatchReader(FillFn fill, size_t batchRows, size_t rowBytes, int depth);
+  ~BatchReader();
+
+  BatchReader(const BatchReader&) = delete;
+  BatchReader& operator=(const BatchReader&) = delete;
+
+  // Next batch in input order; 'rows' < batchRows marks the end of input.
+  // The batch returned by the previous call is recycled. Rethrows any
+  // exception raised while filling.
+  const uint8_t* next(size_t& rows);
+
+ private:
+  struct Batch {
+    uint8_t* data;
+    size_t rows;
+  };
+
+  FillFn fill_;
+  size_t batchRows_;
+  std::vector<std::vector<uint8_t>> storage_;
+
+  std::mutex mtx_;
+  std::condition_variable cv_;
+  std::deque<Batch> filled_;
+  std::vector<uint8_t*> free_;
+  uint8_t* inUse_{nullptr};
+  bool done_{false};
+  bool stop_{false};
+  std::exception_ptr error_;
+  std::thread thread_;
+
+  void run();
+};
+
+// Inflates a gzip stream (one or more members) on a background thread and
+// serves the result as a std::streambuf, so decompression overlaps with
+// parsing and compression. Needs a build with IO_HAVE_ZLIB.
+class GzipReader : public std::streambuf {
+ public:
+  // Copy up to 'max' compressed bytes into 'dst'; 0 means end of input
+  using SourceFn = std::function<size_t(char* dst, size_t max)>;
+
+  explicit GzipReader(SourceFn source);
+  ~GzipReader() override;
+
+  GzipReader(const GzipReader&) = delete;
+  GzipReader& operator=(const GzipReader&) = delete;
+
+  // True when 'data' starts with the gzip magic bytes
+  static bool isGzip(const char* data, size_t size);
+
+ protected:
+  int_type underflow() override;
+
+ private:
+  struct Inflater;
+  std::unique_ptr<Inflater> inflater_;
+  bool done_{false};
+  // Declared last so the inflating thread stops before inflater_ goes away
+  std::unique_ptr<BatchReader> reader_;
+
+  static constexpr size_t kBlockBytes_ = 1 << 20;
+  static constexpr int kDepth_ = 4;
+};
+
+// Output encodings for Endpoint::write()
+//
+// Csv:    one "x,y,z,dx,dy,dz,name" line per block.
+// Binary: "BMC1", then varints W,H,D,PX,PY,PZ and the label count, then per
+//         label its tag byte, varint name length and name bytes. The body is
+//         a sequence of records, one per run of blocks sharing a parent:
+//         varint block count, varint parent indices (nx, ny, nz), then per
+//         block varints (x-ox, y-oy, z-oz, dx-1, dy-1, dz-1) relative to the
+//         parent origin followed by a 1-byte label id. Varints are LEB128.
+enum class OutputFormat { Csv, Binary };
+
+// Input models are either the text format (CSV header, label lines, W x H
+// tag characters per slice) or the packed format written by
+// Endpoint::emitPacked(): "BMI1", varints W,H,D,PX,PY,PZ, the label table
+// encoded as for Binary output, then every row as a mode byte followed by
+// W raw id bytes (mode 0) or (varint length, id byte) runs (mode 1).
+// Endpoint detects the packed format from its magic.
+
+// Byte offset of every slice of a model file, for random access by Z.
+// Built by Endpoint::buildSliceIndex() and kept as a sidecar file.
+struct SliceIndex {
+  uint64_t fileSize{0};
+  // offsets[z] is where slice z starts; offsets.back() is the end of the
+  // last complete slice, so there is one more offset than slices.
+  std::vector<uint64_t> offsets;
+  // FNV-1a of each slice's bytes, used to reject a stale index
+  std::vector<uint32_t> checksums;
+
+  int slices() const;
+
+  void save(std::ostream& out) const;
+  static SliceIndex load(std::istream& in);
+};
+
+// Decode a Binary stream produced by Endpoint back to CSV lines
+void binaryToCsv(std::istream& in, std::ostream& out);
+
 class Endpoint {
  private:
   std::istream* in_{nullptr};
   std::ostream* out_{nullptr};
 
+  // Mapped input (takes precedence over in_ when present)
+  std::unique_ptr<MappedFile> mapped_;
+  size_t cursor_{0};
+
   // Owned table and grid
   std::unique_ptr<Model::LabelTable> labelTable_;
   // Reusable parent block buffer (for streaming - only holds one parent at a time)
-  std::unique_ptr<Model::Grid> parent_;  
+  std::unique_ptr<Model::Grid> parent_;
+  // Label census of parent_, gathered while it is filled
+  Model::Census census_;
   // Copy of parent dimensions
   int parentX_{0}, parentY_{0}, parentZ_{0};
 
@@ -33,46 +188,151 @@ class Endpoint {
   // Iteration state over parent blocks
   int nx_{0}, ny_{0}, nz_{0};
 
+  // Slice window set by setZWindow()
+  int zBegin_{0};
+  int zEnd_{std::numeric_limits<int>::max()};
+
   // COntrol flags
   bool initialized_{false};
   bool eof_{false};
 
   // Streaming buffer: keep only PZ slices (each slice holds H rows of W chars)
   bool chunkLoaded_{false};
-  std::vector<std::string> chunkLines_;  // size = parentZ_ * H_
+  // Current Z-chunk as translated label ids: parentZ_ slices of W_ x H_
+  // bytes, row-major. Allocated once in init() and reused for every chunk.
+  std::vector<uint8_t> slabStorage_;
+  uint8_t* slabBuf_{nullptr};  // 64-byte aligned view into slabStorage_
+  const uint8_t* slab_{nullptr};  // chunk being consumed
+  std::string lineScratch_;
+  size_t rowsRead_{0};
 
-  // Load next Z-chunk (parentZ_ slices) into chunkLines_
+  // Load next Z-chunk (parentZ_ slices) into slab_
   void loadZChunk();
 
+  // Read up to maxRows rows, translated to ids, into dst (W_ bytes per row);
+  // consumes the optional blank line after each slice. Returns rows read.
+  size_t readRows(uint8_t* dst, size_t maxRows);
+  size_t readRowsSequential(uint8_t* dst, size_t maxRows);
+  // Mapped text input only: locate row boundaries with a parallel newline
+  // scan, then translate rows concurrently. May return fewer rows than
+  // asked for (e.g. at a window edge); the caller reads the rest in order.
+  size_t readRowsParallel(uint8_t* dst, size_t maxRows);
+
+  // Read the next line (without '\n' / '\r'). In mapped mode 'line' points
+  // into the mapping and 'scratch' is untouched; otherwise it views 'scratch'.
+  bool readLine(std::string& scratch, std::string_view& line);
+  // Next input character without consuming it, or EOF
+  int peekChar();
+
+  // Packed input (see emitPacked)
+  bool packedInput_{false};
+  bool detectPackedInput();
+  bool readPackedRow(uint8_t* dst);
+  bool readByte(uint8_t& b);
+  bool readBytes(uint8_t* dst, size_t n);
+  uint32_t readVarintIn();
+
   // Buffered output to speed up writes
+  OutputFormat outFormat_{OutputFormat::Csv};
+  bool outHeaderWritten_{false};
+  void writeBinaryHeader();
+  void writeBinary(const std::vector<Model::BlockDesc>& blocks);
   std::string outBuf_;
   static constexpr size_t kFlushThreshold_ = 1 << 20;  // 1 MiB
+  static constexpr size_t kSlabAlign_ = 64;
   void flushOut();
 
+  // Parallel ingest (setIngestThreads > 1), with scan buffers reused
+  // across batches
+  std::unique_ptr<Parallel::ThreadPool> ingestPool_;
+  size_t ingestThreads_{1};
+  std::vector<std::vector<size_t>> newlines_;
+  std::vector<size_t> lineEnds_;
+  std::vector<std::string_view> rowViews_;
+  static constexpr size_t kParallelIngestMinBytes_ = 1 << 20;
+
+  // Gzip input: detected in init(), after which in_ reads the inflated
+  // stream. A gzipped mapping moves to gzipSource_ and mapped_ is cleared.
+  std::unique_ptr<MappedFile> gzipSource_;
+  std::unique_ptr<GzipReader> gzipBuf_;
+  std::unique_ptr<std::istream> gzipStream_;
+  bool detectGzipInput();
+
+  // emitRLEXY() Z-stacking, see setStackZ()
+  bool stackZ_{false};
+
+  // Background reader, created on first read when prefetchDepth_ > 0.
+  // Declared last so it is joined before the input it reads is destroyed.
+  int prefetchDepth_{0};
+  std::unique_ptr<BatchReader> prefetcher_;
+
  public:
   // Construct with explicit streams
   Endpoint(std::istream& in, std::ostream& out);
+  // Construct over a mapped input file
+  Endpoint(std::unique_ptr<MappedFile> in, std::ostream& out);
   ~Endpoint();
 
   // Parse header + label table, validate obvious invariants.
   void init();
 
+  // Read up to 'depth' Z-chunks (or slices, for emitRLEXY) ahead on a
+  // background thread. 0 (default) reads synchronously. Call before the
+  // first parent/row is read.
+  void setPrefetch(int depth);
+
+  // Parse and translate mapped text input on 'threads' threads (1 = off)
+  void setIngestThreads(size_t threads);
+
+  // Scan the rest of a mapped input and record where every slice starts,
+  // stopping after 'maxSlices' slices. The read position is restored, so
+  // parents can still be read after.
+  [[nodiscard]] SliceIndex buildSliceIndex(
+      int maxSlices = std::numeric_limits<int>::max());
+
+  // Restrict nextParent()/emitRLEXY() to slices [zBegin, zEnd), seeking
+  // straight to zBegin through 'index'. Both bounds must be multiples of
+  // the parent depth (zEnd may also be the model depth). Mapped input only;
+  // call after init() and before reading.
+  void setZWindow(const SliceIndex& index, int zBegin, int zEnd);
+  // Whether 'index' was built from this input: same file size and the same
+  // checksum for every indexed slice of [zBegin, zEnd)
+  [[nodiscard]] bool indexMatches(const SliceIndex& index, int zBegin,
+                                  int zEnd) const;
+
   // Check if another read can be process
   [[nodiscard]] bool hasNextParent() const;
 
   // Read and materialize the next parent block from the input stream
   [[nodiscard]] Model::ParentBlock nextParent();
+  // Same, filling a caller-owned grid (from newParentGrid()) and census
+  // instead of the shared buffer, so several parents can be alive at once
+  [[nodiscard]] Model::ParentBlock nextParent(Model::Grid& grid,
+                                              Model::Census& census);
+  // Empty grid shaped for nextParent(Grid&, Census&); call after init()
+  [[nodiscard]] Model::Grid newParentGrid() const;
 
   // Write the label table to the output stream
   [[nodiscard]] const Model::LabelTable& labels() const;
 
+  // Select the encoding used by write(); call before the first write
+  void setOutputFormat(OutputFormat format);
+
   // write the output
   void write(const std::vector<Model::BlockDesc>& blocks);
   // Optional explicit flush
   void flush();
 
+  // Let emitRLEXY() stack blocks in Z within each parent-Z window
+  // (Strategy::StreamRLEXY::setStackZ); off by default
+  void setStackZ(bool on);
+
   // Fast streaming path that leverages Strategy::StreamRLEXY
   void emitRLEXY();
+
+  // Re-encode the whole input as a packed model on the output stream.
+  // With 'rle' each row is run-length coded when that is smaller.
+  void emitPacked(bool rle = true);
 };
 };  // namespace IO
 
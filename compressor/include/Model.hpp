@@ -2,8 +2,11 @@
 #define MODEL_HPP
 
 #include <algorithm>
+#include <array>
 #include <cassert>
 #include <cstdint>
+#include <memory>
+#include <mutex>
 #include <stack>
 #include <stdexcept>
 #include <string>
@@ -19,37 +22,187 @@ struct BlockDesc {
   uint32_t labelId{};
 };
 
+// Storage width of a grid cell. Label ids fit a byte (LabelTable is keyed
+// by char); models with at most 16 labels can pack two cells per byte.
+enum class CellWidth { Byte, Nibble };
+
 class Grid {
  private:
   int W{}, H{}, D{};
-  std::vector<uint32_t> cells;
+  CellWidth width_{CellWidth::Byte};
+  std::vector<uint8_t> cells;
   inline size_t idx(int x, int y, int z) const;
 
  public:
-  Grid(int w, int h, int d);
+  // Writable view of one cell, returned by the non-const at()
+  class CellRef {
+   private:
+    Grid* g;
+    size_t i;
+
+   public:
+    CellRef(Grid* g, size_t i) : g(g), i(i) {}
+    operator uint32_t() const { return g->get(i); }
+    CellRef& operator=(uint32_t id) {
+      g->put(i, id);
+      return *this;
+    }
+  };
+
+  Grid(int w, int h, int d, CellWidth width = CellWidth::Byte);
+
+  // Narrowest width that can hold 'labels' distinct ids
+  static CellWidth widthFor(size_t labels);
 
   // Dimension
   int width() const;
   int height() const;
   int depth() const;
+  CellWidth cellWidth() const;
 
   // element access
-  uint32_t& at(int x, int y, int z);
-  const uint32_t& at(int x, int y, int z) const;
+  CellRef at(int x, int y, int z);
+  uint32_t at(int x, int y, int z) const;
+  // Store n ids along x starting at (x, y, z)
+  void setRow(int x, int y, int z, const uint8_t* ids, size_t n);
+  // Copy the width() ids of row (y, z) into dst, one byte each
+  void copyRow(int y, int z, uint8_t* dst) const;
 
-  // raw data
+  // raw data: one id per byte, or for Nibble two ids per byte with the
+  // even cell in the low nibble
   size_t size() const;
-  uint32_t* data();
-  const uint32_t* data() const;
+  size_t bytes() const;
+  uint8_t* data();
+  const uint8_t* data() const;
+
+ private:
+  uint32_t get(size_t i) const;
+  void put(size_t i, uint32_t id);
+};
+
+inline size_t Grid::idx(int x, int y, int z) const {
+  assert(x >= 0 && x < W);
+  assert(y >= 0 && y < H);
+  assert(z >= 0 && z < D);
+  return static_cast<size_t>(x) + static_cast<size_t>(y) * W +
+         static_cast<size_t>(z) * W * H;
+}
+
+// Cell access sits on every strategy's inner loop, so it stays inline
+inline uint32_t Grid::get(size_t i) const {
+  if (width_ == CellWidth::Byte) return cells[i];
+  return (cells[i >> 1] >> ((i & 1) * 4)) & 0xFu;
+}
+
+inline void Grid::put(size_t i, uint32_t id) {
+  if (width_ == CellWidth::Byte) {
+    cells[i] = static_cast<uint8_t>(id);
+    return;
+  }
+  assert(id < 16);
+  const unsigned shift = (i & 1) * 4;
+  uint8_t& b = cells[i >> 1];
+  b = static_cast<uint8_t>((b & ~(0xFu << shift)) | ((id & 0xFu) << shift));
+}
+
+inline Grid::CellRef Grid::at(int x, int y, int z) {
+  return CellRef(this, idx(x, y, z));
+}
+
+inline uint32_t Grid::at(int x, int y, int z) const { return get(idx(x, y, z)); }
+
+// One bit per cell for every label id in a grid: bit (x % 64) of word
+// (x / 64) in the row for (label, y, z). Built in a single pass.
+class BitPlanes {
+ private:
+  int W{}, H{}, D{};
+  size_t words{};
+  size_t labels{};
+  std::vector<uint64_t> bits;
+  // Row returned for labels that do not occur in the grid
+  std::vector<uint64_t> zeros;
+  std::vector<uint8_t> present;
+
+ public:
+  explicit BitPlanes(const Grid& g);
+
+  size_t wordsPerRow() const;
+  // Ids below this may have set bits
+  size_t labelCount() const;
+  // True when at least one cell carries the label
+  bool contains(uint32_t labelId) const;
+
+  const uint64_t* row(uint32_t labelId, int y, int z) const;
+  bool test(uint32_t labelId, int x, int y, int z) const;
 };
 
+inline const uint64_t* BitPlanes::row(uint32_t labelId, int y, int z) const {
+  if (labelId >= labels) return zeros.data();
+  return bits.data() +
+         ((static_cast<size_t>(labelId) * D + z) * H + y) * words;
+}
+
+inline bool BitPlanes::test(uint32_t labelId, int x, int y, int z) const {
+  return (row(labelId, y, z)[x >> 6] >> (x & 63)) & 1u;
+}
+
+// Cell count and tight bounding box of one label within a parent. The box
+// is [x0, x1) x [y0, y1) x [z0, z1) in parent-local coordinates.
+struct LabelBox {
+  uint32_t count{0};
+  int x0{0}, y0{0}, z0{0};
+  int x1{0}, y1{0}, z1{0};
+
+  size_t volume() const;
+  // Every cell of the box carries the label
+  bool solid() const;
+};
+
+// Per-label census of a parent, accumulated row by row while the parent
+// is filled (Endpoint::nextParent) or in one pass over a grid.
+class Census {
+ private:
+  std::vector<LabelBox> boxes;
+  LabelBox empty;
+
+ public:
+  Census() = default;
+  explicit Census(const Grid& g);
+
+  void reset(size_t labels);
+  // Account for the n ids of row (y, z), starting at x = 0
+  void addRow(const uint8_t* ids, int n, int y, int z);
+
+  size_t labelCount() const;
+  bool contains(uint32_t labelId) const;
+  const LabelBox& box(uint32_t labelId) const;
+};
+
+inline size_t LabelBox::volume() const {
+  return static_cast<size_t>(x1 - x0) * (y1 - y0) * (z1 - z0);
+}
+
+inline bool LabelBox::solid() const { return count > 0 && count == volume(); }
+
 class ParentBlock {
  private:
   int ox, oy, oz;
   Grid& gridRef;
 
+  struct PlaneCache {
+    std::once_flag once;
+    std::unique_ptr<BitPlanes> planes;
+    std::once_flag censusOnce;
+    std::unique_ptr<Census> census;
+  };
+  mutable std::shared_ptr<PlaneCache> cache;
+  // Census supplied by whoever filled the grid, if any
+  const Census* censusRef{nullptr};
+
  public:
   ParentBlock(int ox, int oy, int oz, Grid& g);
+  // With a census already gathered for this grid
+  ParentBlock(int ox, int oy, int oz, Grid& g, const Census& census);
 
   int originX() const;
   int originY() const;
@@ -59,8 +212,21 @@ class ParentBlock {
   int sizeY() const;
   int sizeZ() const;
 
+  // Raw grid access; call invalidate() after writing through it
   Grid& grid();
   const Grid& grid() const;
+
+  // Drop the cached planes and census (including one supplied by the
+  // reader) so they are rebuilt from the grid on next use
+  void invalidate();
+
+  // Per-label bit planes of the grid, built on first use and shared by
+  // every strategy (and thread) covering this parent
+  const BitPlanes& planes() const;
+
+  // Per-label counts and bounding boxes; computed on first use when the
+  // parent was built without one
+  const Census& census() const;
 };
 
 class LabelTable {
@@ -69,17 +235,34 @@ class LabelTable {
   std::vector<int> labelToId;
   // id to name
   std::vector<std::string> idToName;
+  // id to tag
+  std::vector<char> idToTag;
+  // tag byte -> id, or kUnknownTag; used by the bulk translate() kernel
+  static constexpr uint16_t kUnknownTag = 0x100;
+  std::array<uint16_t, 256> lut;
 
  public:
   // constructor
   void add(char label, const std::string& name);
-  LabelTable() : labelToId(256, -1) {};
+  LabelTable() : labelToId(256, -1) { lut.fill(kUnknownTag); };
   // lookup
   uint32_t getId(char label) const;
   const std::string& getName(uint32_t id) const;
+  char getTag(uint32_t id) const;
   size_t size() const;
+
+  // Translate n tags to compact ids in a single pass. Returns n when every
+  // tag is known, otherwise the index of the first unknown tag (ids is then
+  // partially written).
+  size_t translate(const char* tags, size_t n, uint8_t* ids) const;
 };
 
+// Run boundaries of a row of label ids: bit i of 'bits' is set when ids[i]
+// starts a run (i == 0 or ids[i] != ids[i - 1]). 'bits' must hold
+// (n + 63) / 64 words. Rows are compared with themselves shifted by one
+// byte, 32 or 16 cells per step, so uniform spans cost no branches.
+void runStarts(const uint8_t* ids, size_t n, uint64_t* bits);
+
 };  // namespace Model
 
 #endif
\ No newline at end of file
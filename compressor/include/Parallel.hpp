@@ -0,0 +1,198 @@
+#ifndef PARALLEL_HPP
+#define PARALLEL_HPP
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace Parallel {
+// Bounded lock-free multi-producer/multi-consumer ring (Vyukov). Each cell
+// carries a sequence number telling producers and consumers whose turn it
+// is, so push and pop are a CAS on one index plus one release store.
+// Capacity is rounded up to a power of two.
+template <class T>
+class BoundedQueue {
+ private:
+  struct Cell {
+    std::atomic<std::size_t> seq;
+    T value;
+  };
+  std::unique_ptr<Cell[]> cells_;
+  std::size_t mask_;
+  alignas(64) std::atomic<std::size_t> tail_{0};  // next push
+  alignas(64) std::atomic<std::size_t> head_{0};  // next pop
+
+ public:
+  explicit BoundedQueue(std::size_t capacity) {
+    std::size_t cap = 2;
+    while (cap < capacity) cap <<= 1;
+    cells_ = std::make_unique<Cell[]>(cap);
+    mask_ = cap - 1;
+    for (std::size_t i = 0; i < cap; ++i)
+      cells_[i].seq.store(i, std::memory_order_relaxed);
+  }
+
+  BoundedQueue(const BoundedQueue&) = delete;
+  BoundedQueue& operator=(const BoundedQueue&) = delete;
+
+  // False when full
+  bool tryPush(T value) {
+    std::size_t pos = tail_.load(std::memory_order_relaxed);
+    Cell* cell;
+    while (true) {
+      cell = &cells_[pos & mask_];
+      const std::size_t seq = cell->seq.load(std::memory_order_acquire);
+      const auto dif = static_cast<std::ptrdiff_t>(seq - pos);
+      if (dif == 0) {
+        if (tail_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+          break;
+      } else if (dif < 0) {
+        return false;
+      } else {
+        pos = tail_.load(std::memory_order_relaxed);
+      }
+    }
+    cell->value = std::move(value);
+    cell->seq.store(pos + 1, std::memory_order_release);
+    return true;
+  }
+
+  // False when empty
+  bool tryPop(T& out) {
+    std::size_t pos = head_.load(std::memory_order_relaxed);
+    Cell* cell;
+    while (true) {
+      cell = &cells_[pos & mask_];
+      const std::size_t seq = cell->seq.load(std::memory_order_acquire);
+      const auto dif = static_cast<std::ptrdiff_t>(seq - (pos + 1));
+      if (dif == 0) {
+        if (head_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+          break;
+      } else if (dif < 0) {
+        return false;
+      } else {
+        pos = head_.load(std::memory_order_relaxed);
+      }
+    }
+    out = std::move(cell->value);
+    cell->seq.store(pos + mask_ + 1, std::memory_order_release);
+    return true;
+  }
+};
+
+// Waiting strategy for lock-free loops: spin briefly, then yield, then
+// sleep, so an idle stage of an endless stream does not burn a core
+class Backoff {
+ private:
+  unsigned rounds_{0};
+
+ public:
+  void pause() {
+    if (rounds_ < 64) {
+      ++rounds_;
+    } else if (rounds_ < 128) {
+      ++rounds_;
+      std::this_thread::yield();
+    } else {
+      std::this_thread::sleep_for(std::chrono::microseconds(200));
+    }
+  }
+  void reset() { rounds_ = 0; }
+};
+
+// Fixed-size pool of worker threads with a shared FIFO task queue
+class ThreadPool {
+ private:
+  std::vector<std::thread> workers_;
+  std::deque<std::function<void()>> tasks_;
+  std::mutex mtx_;
+  std::condition_variable cv_;
+  bool stop_{false};
+
+  void workerLoop();
+
+ public:
+  // 0 threads means one per hardware thread
+  explicit ThreadPool(std::size_t threads = 0);
+  ~ThreadPool();
+
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  std::size_t size() const;
+
+  // Queue a task for any worker
+  void submit(std::function<void()> task);
+
+  // Run fn(i) for every i in [0, n) and return when all have finished. The
+  // calling thread works on the loop too, so nested calls cannot deadlock.
+  // The first exception thrown by fn is rethrown here.
+  void parallelFor(std::size_t n, const std::function<void(std::size_t)>& fn);
+};
+
+// Pool of threads with one task deque each. A thread runs its own newest
+// task first and, when its deque is empty, steals the oldest task of
+// another thread, so uneven tasks still keep every thread busy.
+class StealingPool {
+ private:
+  struct Queue {
+    std::mutex mtx;
+    std::deque<std::function<void()>> tasks;
+  };
+  std::vector<std::unique_ptr<Queue>> queues_;
+  std::vector<std::thread> workers_;
+  // pending_ counts queued tasks; mtx_ and cv_ are only used by threads
+  // going to sleep (counted in sleepers_) and by pushes that wake them
+  std::atomic<std::size_t> pending_{0};
+  std::atomic<std::size_t> sleepers_{0};
+  std::mutex mtx_;
+  std::condition_variable cv_;
+  bool stop_{false};
+  std::atomic<std::size_t> nextQueue_{0};
+
+  void push(std::size_t queue, std::function<void()> task);
+  // Run one task from 'self' or a victim; false when every deque is empty
+  bool runOne(std::size_t self);
+  void workerLoop(std::size_t self);
+
+ public:
+  // 0 threads means one per hardware thread
+  explicit StealingPool(std::size_t threads = 0);
+  ~StealingPool();
+
+  StealingPool(const StealingPool&) = delete;
+  StealingPool& operator=(const StealingPool&) = delete;
+
+  std::size_t size() const;
+
+  // Queue a task: on the calling thread's deque when it is a pool thread,
+  // otherwise on the deques in turn
+  void submit(std::function<void()> task);
+
+  // Run fn(i) for every i in [0, n) and return when all have finished.
+  // Helper tasks let idle threads steal iterations; the caller runs the
+  // iterations nobody took and never picks up unrelated tasks, then blocks.
+  // The first exception thrown by fn is rethrown here.
+  void parallelFor(std::size_t n, const std::function<void(std::size_t)>& fn);
+
+  // Pool whose thread is calling, if any
+  static StealingPool* current();
+};
+
+// Process-wide pool sized to the hardware
+ThreadPool& defaultPool();
+
+// parallelFor on the StealingPool the caller runs on, so nested loops
+// become stealable tasks; defaultPool() everywhere else
+void parallelFor(std::size_t n, const std::function<void(std::size_t)>& fn);
+
+};  // namespace Parallel
+
+#endif
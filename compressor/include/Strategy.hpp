@@ -1,6 +1,10 @@
 #ifndef STRATEGY_HPP
 #define STRATEGY_HPP
 
+#include <atomic>
+#include <string_view>
+#include <unordered_map>
+
 #include "Model.hpp"
 
 namespace Strategy {
@@ -8,96 +12,189 @@ class GroupingStrategy {
  public:
   virtual ~GroupingStrategy() = default;
 
-  // Setup function to override in the fuure
-  virtual std::vector<Model::BlockDesc> cover(
-      const Model::ParentBlock& parent, uint32_t labelId) = 0;
+  // Cover one label of the parent. The parent's census answers absent
+  // labels (no blocks) and labels that fill their bounding box (one block)
+  // directly; otherwise coverLabel() runs on the bounding box only.
+  std::vector<Model::BlockDesc> cover(const Model::ParentBlock& parent,
+                                      uint32_t labelId);
+  // Same, into 'out' (cleared first) so a caller that covers many labels
+  // can keep reusing its capacity
+  void cover(const Model::ParentBlock& parent, uint32_t labelId,
+             std::vector<Model::BlockDesc>& out);
+
+  // Cover every label of the parent, appending to 'out' in label order -
+  // the same blocks as calling cover() for each label id in turn. The
+  // default does exactly that, skipping labels absent from the parent.
+  virtual void coverAll(const Model::ParentBlock& parent,
+                        std::vector<Model::BlockDesc>& out);
+
+  // Whether coverAll() handles every label in one pass over the parent,
+  // cheaper than a cover() call per label. Workers then keep a parent in
+  // one task instead of splitting it by label.
+  virtual bool singlePass() const { return false; }
+
+ protected:
+  // Strategy body, called with a parent cropped to the label's bounding
+  // box. Strategies override one of the two forms; each defaults to the
+  // other.
+  virtual std::vector<Model::BlockDesc> coverLabel(
+      const Model::ParentBlock& parent, uint32_t labelId);
+  // Output form: replaces the contents of 'out'
+  virtual void coverLabel(const Model::ParentBlock& parent, uint32_t labelId,
+                          std::vector<Model::BlockDesc>& out);
+
+  // Whether coverLabel() may run on the cropped bounding box. Strategies
+  // whose heuristics depend on the whole parent return false.
+  virtual bool cropsToLabel() const { return true; }
+
+  // Census answer for 'labelId' without running the strategy, if any
+  static bool coverTrivial(const Model::ParentBlock& parent, uint32_t labelId,
+                           std::vector<Model::BlockDesc>& out);
 };
 
+// Lower bound on the number of blocks in any exact cover of 'labelId' in
+// the parent. Every block has 8 corner cells, and a cell whose neighbours
+// towards one of its corners are all outside the label must be that corner
+// of its block; the same holds per slice with 4 corners per rectangle.
+size_t coverLowerBound(const Model::ParentBlock& parent, uint32_t labelId);
+
+// Post-pass over any strategy's output: merge blocks of the same label
+// that share a whole face until no such pair is left. Blocks are indexed
+// by face in hash maps, so each pass is linear in the block count. The
+// result is sorted by (z, y, x).
+std::vector<Model::BlockDesc> mergeBlocks(std::vector<Model::BlockDesc> blocks);
+
 class DefaultStrat : public GroupingStrategy {
- public:
+ protected:
   // Emit 1 block per cell
-  std::vector<Model::BlockDesc> cover(const Model::ParentBlock& parent,
-                                             uint32_t labelId) override;
+  std::vector<Model::BlockDesc> coverLabel(const Model::ParentBlock& parent,
+                                           uint32_t labelId) override;
 };
 
 class GreedyStrat : public GroupingStrategy {
- public:
+ protected:
   // Group horizontaly, then merge vertically
-  std::vector<Model::BlockDesc> cover(const Model::ParentBlock& parent,
-                                             uint32_t labelId) override;
+  void coverLabel(const Model::ParentBlock& parent, uint32_t labelId,
+                  std::vector<Model::BlockDesc>& out) override;
+
+ public:
+  // Single pass: rows are split into runs by label change
+  void coverAll(const Model::ParentBlock& parent,
+                std::vector<Model::BlockDesc>& out) override;
+  bool singlePass() const override { return true; }
 };
 
 class MaxRectStrat : public GroupingStrategy {
- public:
+ protected:
   // Use the largest rectangle that fits in the parent block
-  std::vector<Model::BlockDesc> cover(const Model::ParentBlock& parent,
-                                             uint32_t labelId) override;
+  void coverLabel(const Model::ParentBlock& parent, uint32_t labelId,
+                  std::vector<Model::BlockDesc>& out) override;
 };
 
 // RLE along X + vertical merge within a single ParentBlock (dz=1 per slice)
 class RLEXYStrat : public GroupingStrategy {
+ protected:
+  std::vector<Model::BlockDesc> coverLabel(const Model::ParentBlock& parent,
+                                           uint32_t labelId) override;
+
  public:
-  std::vector<Model::BlockDesc> cover(const Model::ParentBlock& parent,
-                                      uint32_t labelId) override;
+  // Single pass: rows are split into runs by label change
+  void coverAll(const Model::ParentBlock& parent,
+                std::vector<Model::BlockDesc>& out) override;
+  bool singlePass() const override { return true; }
 };
 
 // Optimal 3D compression: MaxRect in XY + aggressive Z-stacking
 class Optimal3DStrat : public GroupingStrategy {
- public:
-  std::vector<Model::BlockDesc> cover(const Model::ParentBlock& parent,
-                                      uint32_t labelId) override;
+ protected:
+  void coverLabel(const Model::ParentBlock& parent, uint32_t labelId,
+                  std::vector<Model::BlockDesc>& out) override;
 };
 
 // Smart Merge Strategy: MaxRect + post-processing to merge adjacent blocks
 // Expected improvement: 5-10% better compression than MaxRect alone
 class SmartMergeStrat : public GroupingStrategy {
+ protected:
+  void coverLabel(const Model::ParentBlock& parent, uint32_t labelId,
+                  std::vector<Model::BlockDesc>& out) override;
+
  public:
-  std::vector<Model::BlockDesc> cover(const Model::ParentBlock& parent,
-                                      uint32_t labelId) override;
+  // Totals over every label that reached the candidate strategies
+  struct Stats {
+    uint64_t labels{0};
+    uint64_t lowerBound{0};  // sum of coverLowerBound()
+    uint64_t blocks{0};      // sum of the chosen covers
+    uint64_t earlyExits{0};  // labels settled by a candidate near the bound
+    uint64_t skipped{0};     // candidates never run
+  };
+
+  // Candidates run cheapest first; the first one whose cover has at most
+  // bound * (1 + tolerance) blocks is taken without running the rest.
+  explicit SmartMergeStrat(double tolerance = 0.0);
+
+  Stats stats() const;
+
   // Merge adjacent blocks that can be combined into larger rectangles
+  // (see mergeBlocks)
   static std::vector<Model::BlockDesc> mergeAdjacentBlocks(
       std::vector<Model::BlockDesc> blocks);
+
+ private:
+  // Parents at least this large evaluate the candidates in parallel
+  static constexpr size_t kParallelCells_ = 16 * 16 * 16;
+
+  double tolerance_;
+  std::atomic<uint64_t> labels_{0}, lowerBound_{0}, blocks_{0},
+      earlyExits_{0}, skipped_{0};
 };
 
 // MaxCuboidStrat — Iterative maximum-volume uniform cuboid extraction
 // Slow but achieves maximum compression by finding globally optimal largest cuboids
 // Use this when compression ratio is more important than speed
 class MaxCuboidStrat : public GroupingStrategy {
- public:
-  std::vector<Model::BlockDesc> cover(const Model::ParentBlock& parent,
-                                      uint32_t labelId) override;
+ protected:
+  std::vector<Model::BlockDesc> coverLabel(const Model::ParentBlock& parent,
+                                           uint32_t labelId) override;
+
+ private:
+  // Parents at least this large search starting slices in parallel
+  static constexpr size_t kParallelCells_ = 32 * 32 * 32;
 };
 
 // LayeredSliceStrat — Z-first approach that groups identical XY slices
 // Best for datasets with many repeated Z-layers (geological layers, building floors)
 class LayeredSliceStrat : public GroupingStrategy {
- public:
-  std::vector<Model::BlockDesc> cover(const Model::ParentBlock& parent,
-                                      uint32_t labelId) override;
+ protected:
+  void coverLabel(const Model::ParentBlock& parent, uint32_t labelId,
+                  std::vector<Model::BlockDesc>& out) override;
 };
 
 // QuadTreeStrat — Hierarchical recursive quadrant subdivision
 // Best for datasets with large uniform regions at different scales
 class QuadTreeStrat : public GroupingStrategy {
- public:
-  std::vector<Model::BlockDesc> cover(const Model::ParentBlock& parent,
-                                      uint32_t labelId) override;
+ protected:
+  std::vector<Model::BlockDesc> coverLabel(const Model::ParentBlock& parent,
+                                           uint32_t labelId) override;
+  // Quadrants are aligned to the parent extents
+  bool cropsToLabel() const override { return false; }
 };
 
 // ScanlineStrat — Left-to-right sweep with active rectangles
 // Best for datasets with Manhattan-like structures (orthogonal boundaries)
 class ScanlineStrat : public GroupingStrategy {
- public:
-  std::vector<Model::BlockDesc> cover(const Model::ParentBlock& parent,
-                                      uint32_t labelId) override;
+ protected:
+  void coverLabel(const Model::ParentBlock& parent, uint32_t labelId,
+                  std::vector<Model::BlockDesc>& out) override;
 };
 
 // AdaptiveStrat — Analyzes data characteristics and picks best strategy per region
 // Best for mixed/heterogeneous datasets
 class AdaptiveStrat : public GroupingStrategy {
- public:
-  std::vector<Model::BlockDesc> cover(const Model::ParentBlock& parent,
-                                      uint32_t labelId) override;
+ protected:
+  std::vector<Model::BlockDesc> coverLabel(const Model::ParentBlock& parent,
+                                           uint32_t labelId) override;
+  // Density and Z-correlation are measured over the whole parent
+  bool cropsToLabel() const override { return false; }
 };
 
 // Streaming strategy for fast RLE along X and vertical merge within
@@ -108,11 +205,23 @@ class StreamRLEXY {
               const Model::LabelTable& labels);
 
   // Process one row of slice z at row y. Appends emitted blocks to 'out'.
-  void onRow(int z, int y, const std::string& row,
+  void onRow(int z, int y, std::string_view row,
              std::vector<Model::BlockDesc>& out);
+  // Same as onRow() for a row already translated to label ids
+  void onRowIds(int z, int y, const uint8_t* ids,
+                std::vector<Model::BlockDesc>& out);
 
   // Flush any active groups at slice end (defensive, usually empty).
   void onSliceEnd(int z, std::vector<Model::BlockDesc>& out);
+  // Flush blocks still held for Z-stacking once the input ends
+  void onStreamEnd(std::vector<Model::BlockDesc>& out);
+
+  // Stack finished groups in Z within each window of PZ slices: a group
+  // that recurs with the same extent and label in the next slice grows
+  // its block instead of starting a new one. Only the groups that ended
+  // in the previous slice are kept, never cells. 0 (default) emits every
+  // group with dz = 1 as soon as it ends.
+  void setStackZ(int PZ);
 
  private:
   struct Group {
@@ -122,6 +231,18 @@ class StreamRLEXY {
     uint32_t labelId;
   };
   struct Run { int x0, x1; uint32_t labelId; };
+  // Group identity across slices, and the block it has grown so far
+  struct StackKey {
+    int x0, x1, startY, height;
+    uint32_t labelId;
+    bool operator==(const StackKey& o) const {
+      return x0 == o.x0 && x1 == o.x1 && startY == o.startY &&
+             height == o.height && labelId == o.labelId;
+    }
+  };
+  struct StackKeyHash {
+    size_t operator()(const StackKey& k) const;
+  };
 
   const Model::LabelTable& labels_;
   int X_, Y_, Z_, PX_, PY_;
@@ -131,8 +252,22 @@ class StreamRLEXY {
   std::vector<std::vector<Group>> active_;
   std::vector<std::vector<Group>> nextActive_;
   std::vector<std::vector<Run>> currRuns_;
+  // Current row translated to label ids
+  std::vector<uint8_t> rowIds_;
+  // Run boundaries of the current row (Model::runStarts)
+  std::vector<uint64_t> rowStarts_;
+  // Z-stacking (setStackZ): blocks whose last slice is the current or
+  // previous one
+  int PZ_{0};
+  std::unordered_map<StackKey, Model::BlockDesc, StackKeyHash> stacked_;
+  // Finished stacks, sorted before they are emitted
+  std::vector<Model::BlockDesc> flushed_;
+  void drainFlushed(std::vector<Model::BlockDesc>& out);
+
+  // Hand a finished group to the output or to the Z-stack
+  void emit(int z, const Group& g, std::vector<Model::BlockDesc>& out);
 
-  void buildRunsForRow(const std::string& row);
+  void buildRunsForRow(const uint8_t* ids);
   void mergeRow(int z, int y, std::vector<Model::BlockDesc>& out);
   void flushStripeEnd(int z, std::vector<Model::BlockDesc>& out);
   static inline Model::BlockDesc toBlock(int z, const Group& g) {
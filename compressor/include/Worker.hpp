@@ -2,9 +2,14 @@
 #define WORKER_HPP
 
 #include <Model.hpp>
+#include <Parallel.hpp>
 #include <Strategy.hpp>
 #include <memory>
 
+namespace IO {
+class Endpoint;
+};
+
 namespace Worker {
 // Common interface for all workers
 class WorkerBackend {
@@ -13,6 +18,16 @@ class WorkerBackend {
 
   virtual std::vector<Model::BlockDesc> process(
       const Model::ParentBlock& parent, uint32_t labelId) = 0;
+
+  // Cover every label of the parent in label order (see
+  // GroupingStrategy::coverAll). Defaults to process() per present label.
+  virtual void coverAll(const Model::ParentBlock& parent,
+                        std::vector<Model::BlockDesc>& out);
+
+  // Read every remaining parent of an initialized endpoint, cover all its
+  // labels and write the blocks, parent by parent in input order. The
+  // default does it on the calling thread.
+  virtual void compress(IO::Endpoint& ep);
 };
 
 
@@ -28,21 +43,62 @@ class DirectWorker : public WorkerBackend {
   // execute the strategy and get results
   std::vector<Model::BlockDesc> process(const Model::ParentBlock& parent,
                                                uint32_t labelId) override;
+  void coverAll(const Model::ParentBlock& parent,
+                std::vector<Model::BlockDesc>& out) override;
 };
 
+// Covers parents on a work-stealing pool, one task per (parent, label), or
+// per parent for single-pass strategies (GroupingStrategy::singlePass).
+// Nested Parallel::parallelFor loops inside the strategy (SmartMerge
+// candidates, MaxCuboid searches) become stealable tasks too. The strategy
+// instance is shared by the pool threads, so it must not keep per-call
+// state.
 class ThreadWorker : public WorkerBackend {
  private:
   std::unique_ptr<Strategy::GroupingStrategy> strategy_;
   std::size_t poolSize_{0};
+  Parallel::StealingPool pool_;
 
  public:
-  // Construct with a strategy
+  // Construct with a strategy; 0 threads means one per hardware thread
   explicit ThreadWorker(std::unique_ptr<Strategy::GroupingStrategy> strat,
                           std::size_t poolSize);
 
-  // execute the strategy and get results in parallel
+  // Single label calls run on the calling thread
   std::vector<Model::BlockDesc> process(const Model::ParentBlock& parent,
                                                uint32_t labelId) override;
+  // Labels are covered on the pool and appended in label order
+  void coverAll(const Model::ParentBlock& parent,
+                std::vector<Model::BlockDesc>& out) override;
+
+  // Keeps up to two parents per pool thread in flight, each in its own
+  // grid. Output is written in input order, byte-identical to the default.
+  void compress(IO::Endpoint& ep) override;
+};
+
+// Runs reading, covering and writing as concurrent stages joined by bounded
+// lock-free queues: one reader thread, `compressors` threads calling
+// inner->coverAll(), and the calling thread as writer. At most `depth`
+// parents are alive at once, so memory stays bounded however long the
+// stream; a slow writer stalls the reader instead of growing a backlog.
+// Output is written in input order, byte-identical to the default.
+class PipelineWorker : public WorkerBackend {
+ private:
+  std::unique_ptr<WorkerBackend> inner_;
+  std::size_t compressors_{0};
+  std::size_t depth_{0};
+
+ public:
+  // 0 compressors means one per hardware thread; 0 depth means two
+  // parents per compressor
+  explicit PipelineWorker(std::unique_ptr<WorkerBackend> inner,
+                          std::size_t compressors = 0, std::size_t depth = 0);
+
+  std::vector<Model::BlockDesc> process(const Model::ParentBlock& parent,
+                                        uint32_t labelId) override;
+  void coverAll(const Model::ParentBlock& parent,
+                std::vector<Model::BlockDesc>& out) override;
+  void compress(IO::Endpoint& ep) override;
 };
 
 };  // namespace Worker
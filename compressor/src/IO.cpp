@@ -1,8 +1,20 @@
 #include "../include/IO.hpp"
+#include "../include/Parallel.hpp"
 #include "../include/Strategy.hpp"
 #include <charconv>
+#include <cstring>
 #include <limits>
 
+#if defined(IO_HAVE_ZLIB)
+#include <zlib.h>
+#endif
+
+#if !defined(_WIN32)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 using namespace IO;
 
 namespace {
@@ -38,6 +50,84 @@ bool parseCsvInts(const std::string& line, int out[6]) {
   return true;
 }
 
+// 64-byte aligned buffer of 'bytes' bytes carved out of 'storage'
+uint8_t* alignedBuffer(std::vector<uint8_t>& storage, size_t bytes) {
+  constexpr size_t kAlign = 64;
+  storage.assign(bytes + kAlign, 0);
+  const uintptr_t base = reinterpret_cast<uintptr_t>(storage.data());
+  return storage.data() + ((kAlign - base % kAlign) % kAlign);
+}
+
+// Translate the first n tags of 'row' to ids, reporting the first bad column
+void translateRow(const Model::LabelTable& lt, std::string_view row,
+                  uint8_t* ids, size_t n) {
+  const size_t bad = lt.translate(row.data(), n, ids);
+  if (bad != n) {
+    throw std::runtime_error(std::string("Unknown tag: '") + row[bad] +
+                             "' at column " + std::to_string(bad));
+  }
+}
+
+inline void appendVarint(std::string& out, uint32_t v) {
+  while (v >= 0x80) {
+    out.push_back(static_cast<char>((v & 0x7F) | 0x80));
+    v >>= 7;
+  }
+  out.push_back(static_cast<char>(v));
+}
+
+// Returns false on clean EOF before the first byte
+bool readVarint(std::istream& in, uint32_t& v) {
+  v = 0;
+  for (int shift = 0; shift < 35; shift += 7) {
+    const int c = in.get();
+    if (c == EOF) {
+      if (shift == 0) return false;
+      throw std::runtime_error("Truncated varint in binary stream");
+    }
+    v |= static_cast<uint32_t>(c & 0x7F) << shift;
+    if (!(c & 0x80)) return true;
+  }
+  throw std::runtime_error("Malformed varint in binary stream");
+}
+
+uint32_t expectVarint(std::istream& in) {
+  uint32_t v;
+  if (!readVarint(in, v))
+    throw std::runtime_error("Unexpected end of binary stream");
+  return v;
+}
+
+constexpr char kBinaryMagic[4] = {'B', 'M', 'C', '1'};
+constexpr char kPackedMagic[4] = {'B', 'M', 'I', '1'};
+constexpr char kIndexMagic[4] = {'B', 'S', 'I', '1'};
+constexpr uint8_t kPackedRowRaw = 0;
+constexpr uint8_t kPackedRowRle = 1;
+
+uint32_t fnv1a(const char* data, size_t n) {
+  uint32_t h = 2166136261u;
+  for (size_t i = 0; i < n; ++i) {
+    h ^= static_cast<unsigned char>(data[i]);
+    h *= 16777619u;
+  }
+  return h;
+}
+
+// Fixed-width little-endian fields for the index sidecar
+void putLE(std::ostream& out, uint64_t v, int bytes) {
+  for (int i = 0; i < bytes; ++i) out.put(static_cast<char>((v >> (8 * i)) & 0xFF));
+}
+
+uint64_t getLE(std::istream& in, int bytes) {
+  uint64_t v = 0;
+  for (int i = 0; i < bytes; ++i) {
+    const int c = in.get();
+    if (c == EOF) throw std::runtime_error("Truncated slice index");
+    v |= static_cast<uint64_t>(c) << (8 * i);
+  }
+  return v;
+}
+
 bool parseLabelLine(const std::string& line, char& key, std::string& name) {
   auto pos = line.find(',');
   if (pos == std::string::npos) return false;
@@ -52,6 +142,61 @@ bool parseLabelLine(const std::string& line, char& key, std::string& name) {
 }
 }  // namespace
 
+MappedFile::MappedFile(const char* data, size_t size)
+    : data_(data), size_(size) {}
+
+std::unique_ptr<MappedFile> MappedFile::open(int fd) {
+#if defined(_WIN32)
+  (void)fd;
+  return nullptr;
+#else
+  struct stat st;
+  if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size <= 0)
+    return nullptr;
+
+  // Map from offset 0 but start parsing at the current file position, so a
+  // caller that already consumed part of the file is respected.
+  const off_t pos = lseek(fd, 0, SEEK_CUR);
+  const size_t size = static_cast<size_t>(st.st_size);
+  void* addr = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (addr == MAP_FAILED) return nullptr;
+  madvise(addr, size, MADV_SEQUENTIAL);
+
+  const size_t skip = (pos > 0 && static_cast<size_t>(pos) < size)
+                          ? static_cast<size_t>(pos)
+                          : 0;
+  std::unique_ptr<MappedFile> mf(
+      new MappedFile(static_cast<const char*>(addr), size));
+  mf->skip_ = skip;
+  return mf;
+#endif
+}
+
+MappedFile::~MappedFile() {
+#if !defined(_WIN32)
+  if (data_) munmap(const_cast<char*>(data_), size_);
+#endif
+}
+
+const char* MappedFile::data() const { return data_; }
+
+size_t MappedFile::size() const { return size_; }
+
+size_t MappedFile::startOffset() const { return skip_; }
+
+void MappedFile::prefetch(size_t offset, size_t len) const {
+#if !defined(_WIN32)
+  if (offset >= size_) return;
+  const size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+  const size_t begin = offset & ~(page - 1);
+  const size_t end = std::min(size_, offset + len);
+  madvise(const_cast<char*>(data_ + begin), end - begin, MADV_WILLNEED);
+#else
+  (void)offset;
+  (void)len;
+#endif
+}
+
 Endpoint::Endpoint(std::istream& in, std::ostream& out)
     : in_(&in),
       out_(&out),
@@ -59,19 +204,53 @@ Endpoint::Endpoint(std::istream& in, std::ostream& out)
       initialized_(false),
       eof_(false) {}
 
+Endpoint::Endpoint(std::unique_ptr<MappedFile> in, std::ostream& out)
+    : out_(&out),
+      mapped_(std::move(in)),
+      labelTable_(std::make_unique<Model::LabelTable>()),
+      initialized_(false),
+      eof_(false) {
+  cursor_ = mapped_->startOffset();
+}
+
 Endpoint::~Endpoint() { flushOut(); }
 
 void Endpoint::init() {
   if (initialized_) return;
 
-  // 1) Header
-  std::string line;
-  if (!std::getline(*in_, line))
-    throw std::runtime_error("Failed to read header line");
-
+  // 1) Header: packed models start with kPackedMagic, text ones with CSV ints
   int header[6];
-  if (!parseCsvInts(line, header))
-    throw std::runtime_error("Invalid header format (expected 6 CSV ints)");
+  std::string_view view;
+  if (detectGzipInput()) {
+    gzipBuf_ = std::make_unique<GzipReader>(
+        mapped_ ? GzipReader::SourceFn(
+                      [m = mapped_.get(), pos = cursor_](
+                          char* dst, size_t max) mutable {
+                        const size_t n = std::min(max, m->size() - pos);
+                        std::memcpy(dst, m->data() + pos, n);
+                        pos += n;
+                        return n;
+                      })
+                : GzipReader::SourceFn([in = in_](char* dst, size_t max) {
+                    in->read(dst, static_cast<std::streamsize>(max));
+                    return static_cast<size_t>(in->gcount());
+                  }));
+    gzipSource_ = std::move(mapped_);
+    gzipStream_ = std::make_unique<std::istream>(gzipBuf_.get());
+    // Let inflate errors from the reader thread reach the caller
+    gzipStream_->exceptions(std::ios::badbit);
+    in_ = gzipStream_.get();
+  }
+  packedInput_ = detectPackedInput();
+  if (packedInput_) {
+    for (int& v : header) v = static_cast<int>(readVarintIn());
+  } else {
+    if (!readLine(lineScratch_, view))
+      throw std::runtime_error("Failed to read header line");
+    std::string line(view);
+    if (!parseCsvInts(line, header))
+      throw std::runtime_error("Invalid header format (expected 6 CSV ints)");
+  }
 
   W_ = header[0];
   H_ = header[1];
@@ -103,9 +282,20 @@ void Endpoint::init() {
   const bool isInfiniteStream = (D_ == 0 || D_ >= REASONABLE_DEPTH_LIMIT);
   maxNz_ = isInfiniteStream ? std::numeric_limits<int>::max() : (D_ / parentZ_);
 
-  // 2) Label table (until blank line)
-  while (std::getline(*in_, line)) {
-    std::string copy = line;
+  // 2) Label table (until blank line, or counted in packed models)
+  if (packedInput_) {
+    const uint32_t count = readVarintIn();
+    for (uint32_t i = 0; i < count; ++i) {
+      uint8_t key;
+      if (!readByte(key)) throw std::runtime_error("Truncated label table");
+      std::string name(readVarintIn(), '\0');
+      if (!readBytes(reinterpret_cast<uint8_t*>(&name[0]), name.size()))
+        throw std::runtime_error("Truncated label table");
+      labelTable_->add(static_cast<char>(key), name);
+    }
+  }
+  while (!packedInput_ && readLine(lineScratch_, view)) {
+    std::string copy(view);
     trim(copy);
     if (copy.empty()) break;
     char key;
@@ -118,7 +308,9 @@ void Endpoint::init() {
 
   // 3) Prepare reusable parent buffer for streaming
   // We DON'T load the entire model here - it will be streamed chunk-by-chunk!
-  parent_ = std::make_unique<Model::Grid>(parentX_, parentY_, parentZ_);
+  parent_ = std::make_unique<Model::Grid>(
+      parentX_, parentY_, parentZ_,
+      Model::Grid::widthFor(labelTable_->size()));
 
   // 4) Reset parent iteration counters
   nx_ = ny_ = nz_ = 0;
@@ -130,6 +322,8 @@ bool Endpoint::hasNextParent() const {
   if (!initialized_) return false;
   // Check EOF flag - set by loadZChunk() when stream ends
   if (eof_) return false;
+  // Past the end of a finite model or of the Z window
+  if (nz_ >= maxNz_) return false;
 
   // For infinite streams, we need to speculatively load the next chunk
   // to see if there's more data (since maxNz_ might be INT_MAX)
@@ -149,6 +343,16 @@ bool Endpoint::hasNextParent() const {
 }
 
 Model::ParentBlock Endpoint::nextParent() {
+  return nextParent(*parent_, census_);
+}
+
+Model::Grid Endpoint::newParentGrid() const {
+  return Model::Grid(parentX_, parentY_, parentZ_,
+                     Model::Grid::widthFor(labelTable_->size()));
+}
+
+Model::ParentBlock Endpoint::nextParent(Model::Grid& grid,
+                                        Model::Census& census) {
   const int PX = parentX_, PY = parentY_, PZ = parentZ_;
 
   // Ensure current Z-chunk (PZ slices) is loaded
@@ -166,15 +370,16 @@ Model::ParentBlock Endpoint::nextParent() {
   const int originY = ny_ * PY;
   const int originZ = nz_ * PZ;
 
-  // Fill the reusable parent_ grid from chunkLines_
+  // Fill the grid from the slab, taking the label census while each row
+  // is in cache
+  const size_t sliceBytes = static_cast<size_t>(W_) * H_;
+  census.reset(labelTable_->size());
   for (int dz = 0; dz < PZ; ++dz) {
     for (int dy = 0; dy < PY; ++dy) {
-      const std::string& row = chunkLines_[static_cast<size_t>(dz * H_ + (originY + dy))];
-      for (int dx = 0; dx < PX; ++dx) {
-        const char tag = row[static_cast<size_t>(originX + dx)];
-        const uint32_t id = labelTable_->getId(tag);
-        parent_->at(dx, dy, dz) = id;
-      }
+      const uint8_t* src = slab_ + dz * sliceBytes +
+                           static_cast<size_t>(originY + dy) * W_ + originX;
+      grid.setRow(0, dy, dz, src, PX);
+      census.addRow(src, PX, dy, dz);
     }
   }
 
@@ -188,12 +393,19 @@ Model::ParentBlock Endpoint::nextParent() {
     }
   }
 
-  return Model::ParentBlock(originX, originY, originZ, *parent_);
+  return Model::ParentBlock(originX, originY, originZ, grid, census);
 }
 
 const Model::LabelTable& Endpoint::labels() const { return *labelTable_; }
 
+void Endpoint::setOutputFormat(OutputFormat format) { outFormat_ = format; }
+
 void Endpoint::write(const std::vector<Model::BlockDesc>& blocks) {
+  if (outFormat_ == OutputFormat::Binary) {
+    writeBinary(blocks);
+    return;
+  }
+
   // Append formatted lines into a large buffer and flush in big chunks.
   for (const auto& b : blocks) {
     auto append_int = [&](int v) {
@@ -216,35 +428,458 @@ void Endpoint::write(const std::vector<Model::BlockDesc>& blocks) {
   }
 }
 
+void Endpoint::writeBinaryHeader() {
+  outBuf_.append(kBinaryMagic, sizeof(kBinaryMagic));
+  for (int v : {W_, H_, D_, parentX_, parentY_, parentZ_})
+    appendVarint(outBuf_, static_cast<uint32_t>(v));
+  appendVarint(outBuf_, static_cast<uint32_t>(labelTable_->size()));
+  for (uint32_t id = 0; id < labelTable_->size(); ++id) {
+    const std::string& name = labelTable_->getName(id);
+    outBuf_.push_back(labelTable_->getTag(id));
+    appendVarint(outBuf_, static_cast<uint32_t>(name.size()));
+    outBuf_.append(name);
+  }
+  outHeaderWritten_ = true;
+}
+
+void Endpoint::writeBinary(const std::vector<Model::BlockDesc>& blocks) {
+  if (!outHeaderWritten_) writeBinaryHeader();
+
+  // One record per run of consecutive blocks inside the same parent
+  size_t i = 0;
+  while (i < blocks.size()) {
+    const int nx = blocks[i].x / parentX_;
+    const int ny = blocks[i].y / parentY_;
+    const int nz = blocks[i].z / parentZ_;
+    size_t end = i + 1;
+    while (end < blocks.size() && blocks[end].x / parentX_ == nx &&
+           blocks[end].y / parentY_ == ny && blocks[end].z / parentZ_ == nz)
+      ++end;
+
+    const int ox = nx * parentX_, oy = ny * parentY_, oz = nz * parentZ_;
+    appendVarint(outBuf_, static_cast<uint32_t>(end - i));
+    appendVarint(outBuf_, static_cast<uint32_t>(nx));
+    appendVarint(outBuf_, static_cast<uint32_t>(ny));
+    appendVarint(outBuf_, static_cast<uint32_t>(nz));
+    for (; i < end; ++i) {
+      const auto& b = blocks[i];
+      appendVarint(outBuf_, static_cast<uint32_t>(b.x - ox));
+      appendVarint(outBuf_, static_cast<uint32_t>(b.y - oy));
+      appendVarint(outBuf_, static_cast<uint32_t>(b.z - oz));
+      appendVarint(outBuf_, static_cast<uint32_t>(b.dx - 1));
+      appendVarint(outBuf_, static_cast<uint32_t>(b.dy - 1));
+      appendVarint(outBuf_, static_cast<uint32_t>(b.dz - 1));
+      outBuf_.push_back(static_cast<char>(b.labelId));
+    }
+
+    if (outBuf_.size() >= kFlushThreshold_) flushOut();
+  }
+}
+
+void IO::binaryToCsv(std::istream& in, std::ostream& out) {
+  char magic[sizeof(kBinaryMagic)];
+  if (!in.read(magic, sizeof(magic)) ||
+      !std::equal(magic, magic + sizeof(magic), kBinaryMagic))
+    throw std::runtime_error("Not a binary block stream (bad magic)");
+
+  uint32_t dims[6];
+  for (auto& d : dims) d = expectVarint(in);
+  const uint32_t PX = dims[3], PY = dims[4], PZ = dims[5];
+
+  std::vector<std::string> names(expectVarint(in));
+  for (auto& name : names) {
+    in.get();  // tag byte, not needed for CSV
+    name.resize(expectVarint(in));
+    if (!in.read(&name[0], static_cast<std::streamsize>(name.size())))
+      throw std::runtime_error("Truncated label table in binary stream");
+  }
+
+  std::string buf;
+  uint32_t count;
+  while (readVarint(in, count)) {
+    const uint32_t ox = expectVarint(in) * PX;
+    const uint32_t oy = expectVarint(in) * PY;
+    const uint32_t oz = expectVarint(in) * PZ;
+    for (uint32_t k = 0; k < count; ++k) {
+      const uint32_t v[6] = {ox + expectVarint(in), oy + expectVarint(in),
+                             oz + expectVarint(in), expectVarint(in) + 1,
+                             expectVarint(in) + 1,  expectVarint(in) + 1};
+      const int id = in.get();
+      if (id == EOF || static_cast<size_t>(id) >= names.size())
+        throw std::runtime_error("Bad label id in binary stream");
+      for (uint32_t x : v) {
+        char tmp[16];
+        auto res = std::to_chars(tmp, tmp + sizeof(tmp), x);
+        buf.append(tmp, static_cast<size_t>(res.ptr - tmp));
+        buf.push_back(',');
+      }
+      buf.append(names[static_cast<size_t>(id)]);
+      buf.push_back('\n');
+    }
+    if (buf.size() >= (1 << 20)) {
+      out.write(buf.data(), static_cast<std::streamsize>(buf.size()));
+      buf.clear();
+    }
+  }
+  out.write(buf.data(), static_cast<std::streamsize>(buf.size()));
+  out.flush();
+}
+
 void Endpoint::flush() { flushOut(); }
 
+void Endpoint::setPrefetch(int depth) { prefetchDepth_ = std::max(0, depth); }
+
+void Endpoint::setStackZ(bool on) { stackZ_ = on; }
+
 void Endpoint::loadZChunk() {
-  // Read parentZ_ slices; for each slice, read H_ rows of W chars.
-  chunkLines_.assign(static_cast<size_t>(parentZ_ * H_), std::string());
-
-  std::string line;
-  for (int dz = 0; dz < parentZ_; ++dz) {
-    for (int y = 0; y < H_; ++y) {
-      if (!std::getline(*in_, line)) {
-        // For infinite streams, EOF is expected - mark as end of stream
-        eof_ = true;
-        return;
+  // Read parentZ_ slices; each slice holds H_ rows of W_ ids
+  const size_t rows = static_cast<size_t>(parentZ_) * H_;
+  size_t got = 0;
+  if (prefetchDepth_ > 0) {
+    if (!prefetcher_) {
+      prefetcher_ = std::make_unique<BatchReader>(
+          [this](uint8_t* dst, size_t maxRows) { return readRows(dst, maxRows); },
+          rows, static_cast<size_t>(W_), prefetchDepth_);
+    }
+    slab_ = prefetcher_->next(got);
+  } else {
+    if (!slabBuf_) slabBuf_ = alignedBuffer(slabStorage_, rows * W_);
+    got = readRows(slabBuf_, rows);
+    slab_ = slabBuf_;
+  }
+  // For infinite streams, EOF is expected - mark as end of stream
+  if (got < rows) eof_ = true;
+}
+
+int SliceIndex::slices() const {
+  return offsets.empty() ? 0 : static_cast<int>(offsets.size() - 1);
+}
+
+void SliceIndex::save(std::ostream& out) const {
+  out.write(kIndexMagic, sizeof(kIndexMagic));
+  putLE(out, fileSize, 8);
+  putLE(out, static_cast<uint64_t>(checksums.size()), 4);
+  for (size_t z = 0; z < checksums.size(); ++z) {
+    putLE(out, offsets[z], 8);
+    putLE(out, checksums[z], 4);
+  }
+  putLE(out, offsets.empty() ? 0 : offsets.back(), 8);
+}
+
+SliceIndex SliceIndex::load(std::istream& in) {
+  char magic[sizeof(kIndexMagic)];
+  if (!in.read(magic, sizeof(magic)) ||
+      std::memcmp(magic, kIndexMagic, sizeof(magic)) != 0)
+    throw std::runtime_error("Not a slice index (bad magic)");
+  SliceIndex idx;
+  idx.fileSize = getLE(in, 8);
+  const size_t count = static_cast<size_t>(getLE(in, 4));
+  idx.offsets.resize(count + 1);
+  idx.checksums.resize(count);
+  for (size_t z = 0; z < count; ++z) {
+    idx.offsets[z] = getLE(in, 8);
+    idx.checksums[z] = static_cast<uint32_t>(getLE(in, 4));
+  }
+  idx.offsets[count] = getLE(in, 8);
+  return idx;
+}
+
+SliceIndex Endpoint::buildSliceIndex(int maxSlices) {
+  if (!initialized_) init();
+  if (!mapped_)
+    throw std::runtime_error("Slice index needs a regular (mapped) input file");
+
+  const size_t savedCursor = cursor_;
+  const size_t savedRows = rowsRead_;
+
+  SliceIndex idx;
+  idx.fileSize = mapped_->size();
+  std::vector<uint8_t> slice(static_cast<size_t>(W_) * H_);
+  const size_t sliceRows = static_cast<size_t>(H_);
+  while (idx.checksums.size() < static_cast<size_t>(std::max(0, maxSlices))) {
+    const size_t start = cursor_;
+    if (readRows(slice.data(), sliceRows) < sliceRows) break;
+    idx.offsets.push_back(start);
+    idx.checksums.push_back(fnv1a(mapped_->data() + start, cursor_ - start));
+  }
+  if (!idx.checksums.empty()) idx.offsets.push_back(cursor_);
+
+  cursor_ = savedCursor;
+  rowsRead_ = savedRows;
+  return idx;
+}
+
+bool Endpoint::indexMatches(const SliceIndex& index, int zBegin,
+                            int zEnd) const {
+  if (!mapped_ || index.fileSize != mapped_->size()) return false;
+  const int last = std::min(zEnd, index.slices());
+  if (zBegin < 0 || zBegin >= last) return false;
+  for (int z = zBegin; z < last; ++z) {
+    const size_t start = static_cast<size_t>(index.offsets[static_cast<size_t>(z)]);
+    const size_t end = static_cast<size_t>(index.offsets[static_cast<size_t>(z) + 1]);
+    if (start > end || end > mapped_->size() ||
+        fnv1a(mapped_->data() + start, end - start) !=
+            index.checksums[static_cast<size_t>(z)])
+      return false;
+  }
+  return true;
+}
+
+void Endpoint::setZWindow(const SliceIndex& index, int zBegin, int zEnd) {
+  if (!initialized_) init();
+  if (!mapped_)
+    throw std::runtime_error("Z window needs a regular (mapped) input file");
+  if (index.fileSize != mapped_->size())
+    throw std::runtime_error("Slice index does not match input file size");
+  if (zBegin < 0 || zBegin >= zEnd || zBegin >= index.slices())
+    throw std::runtime_error("Z window outside the indexed slices");
+  if (zBegin % parentZ_ || (zEnd % parentZ_ && zEnd != D_))
+    throw std::runtime_error("Z window must be aligned to the parent depth");
+  if (!indexMatches(index, zBegin, zEnd))
+    throw std::runtime_error("Slice index checksum mismatch (stale index?)");
+
+  const size_t start = static_cast<size_t>(index.offsets[static_cast<size_t>(zBegin)]);
+  cursor_ = start;
+  rowsRead_ = static_cast<size_t>(zBegin) * H_;
+  zBegin_ = zBegin;
+  zEnd_ = zEnd;
+  nz_ = zBegin / parentZ_;
+  maxNz_ = std::min(maxNz_, (zEnd + parentZ_ - 1) / parentZ_);
+}
+
+void Endpoint::setIngestThreads(size_t threads) {
+  ingestThreads_ = std::max<size_t>(1, threads);
+  // The calling thread takes part in every parallel loop
+  ingestPool_ = ingestThreads_ > 1
+                    ? std::make_unique<Parallel::ThreadPool>(ingestThreads_ - 1)
+                    : nullptr;
+}
+
+size_t Endpoint::readRows(uint8_t* dst, size_t maxRows) {
+  if (mapped_) {
+    // Ask the kernel to read ahead the next batch while this one is parsed
+    const size_t bytes = maxRows * (static_cast<size_t>(W_) + 2);
+    mapped_->prefetch(cursor_ + bytes, bytes);
+  }
+
+  size_t n = 0;
+  if (ingestPool_ && mapped_ && !packedInput_ &&
+      maxRows * static_cast<size_t>(W_) >= kParallelIngestMinBytes_) {
+    n = readRowsParallel(dst, maxRows);
+  }
+  return n + readRowsSequential(dst + n * W_, maxRows - n);
+}
+
+size_t Endpoint::readRowsParallel(uint8_t* dst, size_t maxRows) {
+  const char* base = mapped_->data();
+  const size_t W = static_cast<size_t>(W_);
+  const size_t H = static_cast<size_t>(H_);
+
+  // 1) Newline scan over a window sized for maxRows rows (CRLF) plus the
+  //    optional blank line after each slice, split across all threads
+  const size_t window = std::min(mapped_->size() - cursor_,
+                                 maxRows * (W + 2) + (maxRows / H + 1) * 2);
+  const size_t parts = ingestThreads_;
+  newlines_.resize(parts);
+  const size_t start = cursor_;
+  ingestPool_->parallelFor(parts, [&](size_t p) {
+    auto& nl = newlines_[p];
+    nl.clear();
+    const char* it = base + start + window * p / parts;
+    const char* end = base + start + window * (p + 1) / parts;
+    while (it < end) {
+      const void* hit = std::memchr(it, '\n', static_cast<size_t>(end - it));
+      if (!hit) break;
+      it = static_cast<const char*>(hit);
+      nl.push_back(static_cast<size_t>(it - base));
+      ++it;
+    }
+  });
+  lineEnds_.clear();
+  for (const auto& nl : newlines_)
+    lineEnds_.insert(lineEnds_.end(), nl.begin(), nl.end());
+
+  // 2) Cut rows in order (one step per row); lines whose newline falls
+  //    outside the window are left to the sequential reader
+  rowViews_.clear();
+  size_t li = 0;
+  while (rowViews_.size() < maxRows && li < lineEnds_.size()) {
+    const size_t end = lineEnds_[li++];
+    size_t len = end - cursor_;
+    if (len > 0 && base[end - 1] == '\r') --len;  // handle CRLF
+    rowViews_.emplace_back(base + cursor_, len);
+    cursor_ = end + 1;
+
+    // Optional blank line between slices — consume if present
+    if (++rowsRead_ % H == 0) {
+      int ch = peekChar();
+      if (ch == '\n' || ch == '\r') {
+        std::string_view blank;
+        readLine(lineScratch_, blank);
+        while (li < lineEnds_.size() && lineEnds_[li] < cursor_) ++li;
       }
-      if (!line.empty() && line.back() == '\r') line.pop_back();  // handle CRLF
-      if ((int)line.size() < W_) {
+    }
+  }
+
+  // 3) Validate and translate rows concurrently
+  const size_t rows = rowViews_.size();
+  ingestPool_->parallelFor(parts, [&](size_t p) {
+    for (size_t r = rows * p / parts; r < rows * (p + 1) / parts; ++r) {
+      if (rowViews_[r].size() < W) {
         throw std::runtime_error("Row too short while streaming model");
       }
-      chunkLines_[static_cast<size_t>(dz * H_ + y)] = std::move(line);
+      translateRow(*labelTable_, rowViews_[r], dst + r * W, W);
+    }
+  });
+  return rows;
+}
+
+size_t Endpoint::readRowsSequential(uint8_t* dst, size_t maxRows) {
+  std::string_view line;
+  size_t n = 0;
+  if (packedInput_) {
+    for (; n < maxRows && readPackedRow(dst); ++n) dst += W_;
+    return n;
+  }
+  for (; n < maxRows; ++n) {
+    if (!readLine(lineScratch_, line)) break;
+    if ((int)line.size() < W_) {
+      throw std::runtime_error("Row too short while streaming model");
     }
+    translateRow(*labelTable_, line, dst, static_cast<size_t>(W_));
+    dst += W_;
+
     // Optional blank line between slices — consume if present
-    int ch = in_->peek();
-    if (ch == '\n' || ch == '\r') {
-      std::getline(*in_, line);
+    if (++rowsRead_ % static_cast<size_t>(H_) == 0) {
+      int ch = peekChar();
+      if (ch == '\n' || ch == '\r') readLine(lineScratch_, line);
+    }
+  }
+  return n;
+}
+
+bool Endpoint::readPackedRow(uint8_t* dst) {
+  uint8_t mode;
+  if (!readByte(mode)) return false;
+  const size_t W = static_cast<size_t>(W_);
+  if (mode == kPackedRowRaw) {
+    if (!readBytes(dst, W)) throw std::runtime_error("Truncated packed row");
+  } else if (mode == kPackedRowRle) {
+    size_t x = 0;
+    while (x < W) {
+      const size_t len = readVarintIn();
+      uint8_t id;
+      if (len == 0 || len > W - x || !readByte(id))
+        throw std::runtime_error("Corrupt run in packed row");
+      std::memset(dst + x, id, len);
+      x += len;
     }
+  } else {
+    throw std::runtime_error("Unknown packed row mode");
   }
+
+  // Ids skip tag validation, but must still be inside the label table
+  const uint8_t maxId = *std::max_element(dst, dst + W);
+  if (maxId >= labelTable_->size())
+    throw std::runtime_error("Label id out of range in packed row");
+  return true;
+}
+
+bool Endpoint::detectGzipInput() {
+  if (mapped_)
+    return GzipReader::isGzip(mapped_->data() + cursor_,
+                              mapped_->size() - cursor_);
+  // Neither text nor packed models can start with the first magic byte
+  return in_->peek() == 0x1f;
+}
+
+bool Endpoint::detectPackedInput() {
+  if (mapped_) {
+    const size_t avail = mapped_->size() - cursor_;
+    if (avail < sizeof(kPackedMagic) ||
+        std::memcmp(mapped_->data() + cursor_, kPackedMagic,
+                    sizeof(kPackedMagic)) != 0)
+      return false;
+    cursor_ += sizeof(kPackedMagic);
+    return true;
+  }
+  // Text headers start with a digit, so the first byte is enough to decide
+  if (in_->peek() != kPackedMagic[0]) return false;
+  char magic[sizeof(kPackedMagic)];
+  if (!in_->read(magic, sizeof(magic)) ||
+      std::memcmp(magic, kPackedMagic, sizeof(magic)) != 0)
+    throw std::runtime_error("Invalid header (bad packed model magic)");
+  return true;
+}
+
+bool Endpoint::readByte(uint8_t& b) {
+  if (mapped_) {
+    if (cursor_ >= mapped_->size()) return false;
+    b = static_cast<uint8_t>(mapped_->data()[cursor_++]);
+    return true;
+  }
+  const int c = in_->get();
+  if (c == EOF) return false;
+  b = static_cast<uint8_t>(c);
+  return true;
+}
+
+bool Endpoint::readBytes(uint8_t* dst, size_t n) {
+  if (mapped_) {
+    if (mapped_->size() - cursor_ < n) return false;
+    std::memcpy(dst, mapped_->data() + cursor_, n);
+    cursor_ += n;
+    return true;
+  }
+  return static_cast<bool>(
+      in_->read(reinterpret_cast<char*>(dst), static_cast<std::streamsize>(n)));
+}
+
+uint32_t Endpoint::readVarintIn() {
+  uint32_t v = 0;
+  for (int shift = 0; shift < 35; shift += 7) {
+    uint8_t b;
+    if (!readByte(b)) throw std::runtime_error("Truncated packed model");
+    v |= static_cast<uint32_t>(b & 0x7F) << shift;
+    if (!(b & 0x80)) return v;
+  }
+  throw std::runtime_error("Malformed varint in packed model");
+}
+
+bool Endpoint::readLine(std::string& scratch, std::string_view& line) {
+  if (mapped_) {
+    const char* base = mapped_->data();
+    const size_t size = mapped_->size();
+    if (cursor_ >= size) return false;
+    const char* start = base + cursor_;
+    const void* nl = std::memchr(start, '\n', size - cursor_);
+    size_t len = nl ? static_cast<size_t>(static_cast<const char*>(nl) - start)
+                    : size - cursor_;
+    cursor_ += nl ? len + 1 : len;
+    if (len > 0 && start[len - 1] == '\r') --len;  // handle CRLF
+    line = std::string_view(start, len);
+    return true;
+  }
+
+  if (!std::getline(*in_, scratch)) return false;
+  if (!scratch.empty() && scratch.back() == '\r') scratch.pop_back();
+  line = scratch;
+  return true;
+}
+
+int Endpoint::peekChar() {
+  if (mapped_) {
+    return cursor_ < mapped_->size()
+               ? static_cast<unsigned char>(mapped_->data()[cursor_])
+               : EOF;
+  }
+  return in_->peek();
 }
 
 void Endpoint::flushOut() {
+  // A binary stream always starts with its header, even with no blocks
+  if (outFormat_ == OutputFormat::Binary && !outHeaderWritten_ && initialized_)
+    writeBinaryHeader();
   if (!outBuf_.empty()) {
     out_->write(outBuf_.data(), static_cast<std::streamsize>(outBuf_.size()));
     out_->flush();
@@ -265,53 +900,271 @@ void Endpoint::emitRLEXY() {
   if (outBuf_.capacity() < kFlushThreshold_) outBuf_.reserve(kFlushThreshold_);
 
   Strategy::StreamRLEXY strat(X, Y, 0, PX, PY, *labelTable_);
+  if (stackZ_) strat.setStackZ(parentZ_);
   std::vector<Model::BlockDesc> blocks;
   blocks.reserve(1024);
 
-  std::string row;
-  int z = 0;
+  // One slice of translated rows per batch, or enough whole slices to
+  // reach the parallel ingest threshold when ingest threads are set
+  const size_t sliceRows = static_cast<size_t>(Y);
+  size_t batchSlices = 1;
+  if (ingestPool_ && mapped_ && !packedInput_) {
+    const size_t sliceBytes = sliceRows * static_cast<size_t>(X);
+    batchSlices = std::max<size_t>(
+        1, (kParallelIngestMinBytes_ + sliceBytes - 1) / sliceBytes);
+  }
+  const size_t batchRows = batchSlices * sliceRows;
+  std::vector<uint8_t> batchStorage;
+  uint8_t* batchBuf = nullptr;
+  if (prefetchDepth_ > 0) {
+    prefetcher_ = std::make_unique<BatchReader>(
+        [this](uint8_t* dst, size_t maxRows) { return readRows(dst, maxRows); },
+        batchRows, static_cast<size_t>(X), prefetchDepth_);
+  } else {
+    batchBuf = alignedBuffer(batchStorage, batchRows * X);
+  }
 
-  // Read until EOF (supports infinite streams!)
-  while (true) {
-    // Process one slice (Y rows)
-    bool sliceComplete = true;
-    for (int y = 0; y < Y; ++y) {
-      if (!std::getline(*in_, row)) {
-        // EOF encountered - this is expected for infinite streams
-        sliceComplete = false;
-        break;
+  int z = zBegin_;
+
+  // Read until EOF (supports infinite streams!) or the end of the Z window
+  bool eof = false;
+  while (!eof && z < zEnd_) {
+    size_t got = 0;
+    const uint8_t* rows = batchBuf;
+    if (prefetcher_) {
+      rows = prefetcher_->next(got);
+    } else {
+      // Do not read past the Z window
+      const size_t left = static_cast<size_t>(zEnd_ - z) * sliceRows;
+      got = readRows(batchBuf, std::min(batchRows, left));
+    }
+    eof = got < batchRows;
+
+    // Process the batch one slice (Y rows) at a time
+    for (size_t first = 0; first < got && z < zEnd_; first += sliceRows) {
+      const size_t n = std::min(sliceRows, got - first);
+      for (size_t y = 0; y < n; ++y) {
+        blocks.clear();
+        strat.onRowIds(z, static_cast<int>(y), rows + (first + y) * X, blocks);
+        if (!blocks.empty()) write(blocks);
       }
-      if (!row.empty() && row.back() == '\r') row.pop_back();
-      if ((int)row.size() < X) {
-        throw std::runtime_error("Row too short while streaming model");
+
+      if (n < sliceRows) {
+        // EOF reached mid-slice
+        break;
       }
+
+      // Slice complete - flush it
       blocks.clear();
-      strat.onRow(z, y, row, blocks);
+      strat.onSliceEnd(z, blocks);
       if (!blocks.empty()) write(blocks);
+
+      ++z;  // Move to next slice
     }
+  }
 
-    if (!sliceComplete) {
-      // EOF reached mid-slice or after complete slice
-      break;
+  blocks.clear();
+  strat.onStreamEnd(blocks);
+  if (!blocks.empty()) write(blocks);
+
+  flushOut();
+}
+
+void Endpoint::emitPacked(bool rle) {
+  if (!initialized_) init();
+
+  outBuf_.append(kPackedMagic, sizeof(kPackedMagic));
+  for (int v : {W_, H_, D_, parentX_, parentY_, parentZ_})
+    appendVarint(outBuf_, static_cast<uint32_t>(v));
+  appendVarint(outBuf_, static_cast<uint32_t>(labelTable_->size()));
+  for (uint32_t id = 0; id < labelTable_->size(); ++id) {
+    const std::string& name = labelTable_->getName(id);
+    outBuf_.push_back(labelTable_->getTag(id));
+    appendVarint(outBuf_, static_cast<uint32_t>(name.size()));
+    outBuf_.append(name);
+  }
+
+  const size_t W = static_cast<size_t>(W_);
+  const size_t sliceRows = static_cast<size_t>(H_);
+  std::vector<uint8_t> sliceStorage;
+  uint8_t* sliceBuf = alignedBuffer(sliceStorage, sliceRows * W);
+  std::string runs;
+
+  // Convert slice by slice until EOF (works for infinite streams too)
+  size_t got;
+  do {
+    got = readRows(sliceBuf, sliceRows);
+    for (size_t r = 0; r < got; ++r) {
+      const uint8_t* row = sliceBuf + r * W;
+      runs.clear();
+      if (rle) {
+        size_t x = 0;
+        while (x < W && runs.size() < W) {
+          size_t end = x + 1;
+          while (end < W && row[end] == row[x]) ++end;
+          appendVarint(runs, static_cast<uint32_t>(end - x));
+          runs.push_back(static_cast<char>(row[x]));
+          x = end;
+        }
+      }
+      // Keep RLE only when it is actually smaller than the raw row
+      if (rle && runs.size() < W) {
+        outBuf_.push_back(static_cast<char>(kPackedRowRle));
+        outBuf_.append(runs);
+      } else {
+        outBuf_.push_back(static_cast<char>(kPackedRowRaw));
+        outBuf_.append(reinterpret_cast<const char*>(row), W);
+      }
     }
+    if (outBuf_.size() >= kFlushThreshold_) flushOut();
+  } while (got == sliceRows);
 
-    // Slice complete - flush it
-    blocks.clear();
-    strat.onSliceEnd(z, blocks);
-    if (!blocks.empty()) write(blocks);
+  flushOut();
+}
 
-    // Optional blank line between slices — consume if present
-    int ch = in_->peek();
-    if (ch == '\n' || ch == '\r') {
-      std::string blank;
-      std::getline(*in_, blank);
-    } else if (ch == EOF || ch == -1) {
-      // No more data
-      break;
+BatchReader::BatchReader(FillFn fill, size_t batchRows, size_t rowBytes,
+                         int depth)
+    : fill_(std::move(fill)), batchRows_(batchRows) {
+  // 'depth' batches in flight plus the one held by the consumer
+  const size_t count = static_cast<size_t>(std::max(1, depth)) + 1;
+  storage_.resize(count);
+  for (auto& s : storage_)
+    free_.push_back(alignedBuffer(s, batchRows * rowBytes));
+  thread_ = std::thread(&BatchReader::run, this);
+}
+
+BatchReader::~BatchReader() {
+  {
+    std::lock_guard<std::mutex> lock(mtx_);
+    stop_ = true;
+  }
+  cv_.notify_all();
+  if (thread_.joinable()) thread_.join();
+}
+
+const uint8_t* BatchReader::next(size_t& rows) {
+  std::unique_lock<std::mutex> lock(mtx_);
+  if (inUse_) {
+    free_.push_back(inUse_);
+    inUse_ = nullptr;
+    cv_.notify_all();
+  }
+  cv_.wait(lock, [&] { return !filled_.empty() || done_; });
+  if (filled_.empty()) {
+    if (error_) std::rethrow_exception(error_);
+    rows = 0;
+    return nullptr;
+  }
+  Batch b = filled_.front();
+  filled_.pop_front();
+  inUse_ = b.data;
+  rows = b.rows;
+  return b.data;
+}
+
+void BatchReader::run() {
+  while (true) {
+    uint8_t* buf = nullptr;
+    {
+      std::unique_lock<std::mutex> lock(mtx_);
+      cv_.wait(lock, [&] { return !free_.empty() || stop_; });
+      if (stop_) return;
+      buf = free_.back();
+      free_.pop_back();
+    }
+
+    size_t rows = 0;
+    std::exception_ptr err;
+    try {
+      rows = fill_(buf, batchRows_);
+    } catch (...) {
+      err = std::current_exception();
     }
 
-    ++z;  // Move to next slice
+    std::lock_guard<std::mutex> lock(mtx_);
+    if (err) {
+      error_ = err;
+      done_ = true;
+    } else {
+      filled_.push_back(Batch{buf, rows});
+      if (rows < batchRows_) done_ = true;
+    }
+    cv_.notify_all();
+    if (done_) return;
   }
+}
 
-  flushOut();
+struct GzipReader::Inflater {
+#if defined(IO_HAVE_ZLIB)
+  SourceFn source;
+  z_stream zs{};
+  std::vector<char> in;
+  bool ended{false};
+
+  explicit Inflater(SourceFn src) : source(std::move(src)), in(1 << 18) {
+    // 16 + MAX_WBITS: accept the gzip wrapper only
+    if (inflateInit2(&zs, 16 + MAX_WBITS) != Z_OK)
+      throw std::runtime_error("inflateInit2 failed");
+  }
+  ~Inflater() { inflateEnd(&zs); }
+
+  // Fill 'dst' completely unless the input ends first
+  size_t fill(uint8_t* dst, size_t max) {
+    zs.next_out = dst;
+    zs.avail_out = static_cast<uInt>(max);
+    while (zs.avail_out > 0 && !ended) {
+      if (zs.avail_in == 0) {
+        const size_t n = source(in.data(), in.size());
+        if (n == 0) {
+          // total_in restarts at every member; non-zero means cut short
+          if (zs.total_in > 0)
+            throw std::runtime_error("Truncated gzip input");
+          ended = true;
+          break;
+        }
+        zs.next_in = reinterpret_cast<Bytef*>(in.data());
+        zs.avail_in = static_cast<uInt>(n);
+      }
+      const int rc = inflate(&zs, Z_NO_FLUSH);
+      if (rc == Z_STREAM_END) {
+        // Concatenated members (e.g. from pigz or 'cat a.gz b.gz')
+        inflateReset(&zs);
+      } else if (rc != Z_OK && rc != Z_BUF_ERROR) {
+        throw std::runtime_error(std::string("Corrupt gzip input: ") +
+                                 (zs.msg ? zs.msg : "inflate failed"));
+      }
+    }
+    return max - zs.avail_out;
+  }
+#else
+  explicit Inflater(SourceFn) {
+    throw std::runtime_error("gzip input not supported in this build");
+  }
+  size_t fill(uint8_t*, size_t) { return 0; }
+#endif
+};
+
+GzipReader::GzipReader(SourceFn source)
+    : inflater_(std::make_unique<Inflater>(std::move(source))) {
+  reader_ = std::make_unique<BatchReader>(
+      [this](uint8_t* dst, size_t max) { return inflater_->fill(dst, max); },
+      kBlockBytes_, 1, kDepth_);
+}
+
+GzipReader::~GzipReader() = default;
+
+bool GzipReader::isGzip(const char* data, size_t size) {
+  return size >= 2 && static_cast<unsigned char>(data[0]) == 0x1f &&
+         static_cast<unsigned char>(data[1]) == 0x8b;
+}
+
+GzipReader::int_type GzipReader::underflow() {
+  if (gptr() < egptr()) return traits_type::to_int_type(*gptr());
+  if (done_) return traits_type::eof();
+  size_t n = 0;
+  char* block = reinterpret_cast<char*>(const_cast<uint8_t*>(reader_->next(n)));
+  if (n < kBlockBytes_) done_ = true;
+  if (n == 0) return traits_type::eof();
+  setg(block, block, block + n);
+  return traits_type::to_int_type(*gptr());
 }
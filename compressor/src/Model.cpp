@@ -1,8 +1,25 @@
 #include "../include/Model.hpp"
 
+#include <cstring>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
 using namespace Model;
 
-Grid::Grid(int w, int h, int d) : W(w), H(h), D(d), cells(w * h * d, 0) {};
+Grid::Grid(int w, int h, int d, CellWidth width)
+    : W(w), H(h), D(d), width_(width) {
+  const size_t n = static_cast<size_t>(w) * h * d;
+  cells.assign(width == CellWidth::Byte ? n : (n + 1) / 2, 0);
+};
+
+CellWidth Grid::widthFor(size_t labels) {
+  return labels <= 16 ? CellWidth::Nibble : CellWidth::Byte;
+}
 
 int Grid::width() const { return W; };
 
@@ -10,31 +27,167 @@ int Grid::height() const { return H; };
 
 int Grid::depth() const { return D; };
 
-inline size_t Grid::idx(int x, int y, int z) const {
-  assert(x >= 0 && x < W);
-  assert(y >= 0 && y < H);
-  assert(z >= 0 && z < D);
-  return static_cast<size_t>(x) + static_cast<size_t>(y) * W +
-         static_cast<size_t>(z) * W * H;
+CellWidth Grid::cellWidth() const { return width_; };
+
+void Grid::setRow(int x, int y, int z, const uint8_t* ids, size_t n) {
+  if (n == 0) return;
+  const size_t start = idx(x, y, z);
+  assert(start + n <= size());
+  if (width_ == CellWidth::Byte) {
+    std::memcpy(cells.data() + start, ids, n);
+    return;
+  }
+  // Nibble: align to a byte boundary, then pack two ids per byte
+  size_t i = 0;
+  if (start & 1) put(start + i++, ids[0]);
+  uint8_t* dst = cells.data() + ((start + i) >> 1);
+  for (; i + 2 <= n; i += 2)
+    *dst++ = static_cast<uint8_t>((ids[i] & 0xFu) | ((ids[i + 1] & 0xFu) << 4));
+  if (i < n) put(start + i, ids[i]);
 }
 
-uint32_t& Grid::at(int x, int y, int z) {
-  return cells[idx(x, y, z)];
-  ;
-};
+void Grid::copyRow(int y, int z, uint8_t* dst) const {
+  const size_t start = idx(0, y, z);
+  if (width_ == CellWidth::Byte) {
+    std::memcpy(dst, cells.data() + start, static_cast<size_t>(W));
+    return;
+  }
+  for (int x = 0; x < W; ++x) dst[x] = static_cast<uint8_t>(get(start + x));
+}
 
-const uint32_t& Grid::at(int x, int y, int z) const {
-  return cells[idx(x, y, z)];
-};
+size_t Grid::size() const { return static_cast<size_t>(W) * H * D; };
+
+size_t Grid::bytes() const { return cells.size(); };
+
+uint8_t* Grid::data() { return cells.data(); };
+
+const uint8_t* Grid::data() const { return cells.data(); };
+
+namespace {
+// True when all 64 bytes at p are equal
+inline bool uniform64(const uint8_t* p) {
+#if defined(__SSE2__)
+  const __m128i first = _mm_set1_epi8(static_cast<char>(p[0]));
+  __m128i eq = _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p)), first);
+  for (int k = 16; k < 64; k += 16)
+    eq = _mm_and_si128(eq, _mm_cmpeq_epi8(_mm_loadu_si128(
+                               reinterpret_cast<const __m128i*>(p + k)),
+                                          first));
+  return _mm_movemask_epi8(eq) == 0xFFFF;
+#else
+  for (int k = 1; k < 64; ++k)
+    if (p[k] != p[0]) return false;
+  return true;
+#endif
+}
+}  // namespace
+
+BitPlanes::BitPlanes(const Grid& g)
+    : W(g.width()),
+      H(g.height()),
+      D(g.depth()),
+      words((static_cast<size_t>(g.width()) + 63) / 64) {
+  const bool nibble = g.cellWidth() == CellWidth::Nibble;
+  if (nibble) {
+    labels = 16;
+  } else if (g.size() > 0) {
+    labels = static_cast<size_t>(*std::max_element(g.data(), g.data() + g.size())) + 1;
+  }
+  bits.assign(labels * D * H * words, 0);
+  zeros.assign(words, 0);
+
+  present.assign(labels, 0);
+
+  std::vector<uint8_t> unpacked(nibble ? static_cast<size_t>(W) : 0);
+  for (int z = 0; z < D; ++z) {
+    for (int y = 0; y < H; ++y) {
+      const uint8_t* ids;
+      if (nibble) {
+        g.copyRow(y, z, unpacked.data());
+        ids = unpacked.data();
+      } else {
+        ids = g.data() + (static_cast<size_t>(z) * H + y) * W;
+      }
+      uint64_t* plane0 = bits.data() + (static_cast<size_t>(z) * H + y) * words;
+      const size_t planeStride = static_cast<size_t>(D) * H * words;
+      for (size_t w = 0; w < words; ++w) {
+        const uint8_t* chunk = ids + w * 64;
+        const int n = std::min(64, W - static_cast<int>(w * 64));
+        // Uniform words (the bulk of a block model) set one plane at once
+        if (n == 64 && uniform64(chunk)) {
+          plane0[chunk[0] * planeStride + w] = ~0ull;
+          present[chunk[0]] = 1;
+          continue;
+        }
+        for (int k = 0; k < n; ++k) {
+          plane0[chunk[k] * planeStride + w] |= 1ull << k;
+          present[chunk[k]] = 1;
+        }
+      }
+    }
+  }
+}
+
+size_t BitPlanes::wordsPerRow() const { return words; }
+
+size_t BitPlanes::labelCount() const { return labels; }
+
+bool BitPlanes::contains(uint32_t labelId) const {
+  return labelId < labels && present[labelId];
+}
+
+Census::Census(const Grid& g) {
+  reset(0);
+  std::vector<uint8_t> ids(static_cast<size_t>(g.width()));
+  for (int z = 0; z < g.depth(); ++z)
+    for (int y = 0; y < g.height(); ++y) {
+      g.copyRow(y, z, ids.data());
+      addRow(ids.data(), g.width(), y, z);
+    }
+}
+
+void Census::reset(size_t labels) { boxes.assign(labels, LabelBox{}); }
+
+void Census::addRow(const uint8_t* ids, int n, int y, int z) {
+  // Rows of a block model are a handful of runs, so work per run
+  int x = 0;
+  while (x < n) {
+    const uint8_t id = ids[x];
+    const int start = x;
+    while (x < n && ids[x] == id) ++x;
+    if (id >= boxes.size()) boxes.resize(static_cast<size_t>(id) + 1);
+    LabelBox& b = boxes[id];
+    if (b.count == 0) {
+      b = LabelBox{0, start, y, z, x, y + 1, z + 1};
+    } else {
+      b.x0 = std::min(b.x0, start);
+      b.x1 = std::max(b.x1, x);
+      b.y0 = std::min(b.y0, y);
+      b.y1 = std::max(b.y1, y + 1);
+      b.z0 = std::min(b.z0, z);
+      b.z1 = std::max(b.z1, z + 1);
+    }
+    b.count += static_cast<uint32_t>(x - start);
+  }
+}
 
-size_t Grid::size() const { return cells.size(); };
+size_t Census::labelCount() const { return boxes.size(); }
 
-uint32_t* Grid::data() { return cells.data(); };
+bool Census::contains(uint32_t labelId) const {
+  return labelId < boxes.size() && boxes[labelId].count > 0;
+}
 
-const uint32_t* Grid::data() const { return cells.data(); };
+const LabelBox& Census::box(uint32_t labelId) const {
+  return labelId < boxes.size() ? boxes[labelId] : empty;
+}
 
 ParentBlock::ParentBlock(int ox, int oy, int oz, Grid& g)
-    : ox(ox), oy(oy), oz(oz), gridRef(g) {};
+    : ox(ox), oy(oy), oz(oz), gridRef(g),
+      cache(std::make_shared<PlaneCache>()) {};
+
+ParentBlock::ParentBlock(int ox, int oy, int oz, Grid& g, const Census& census)
+    : ox(ox), oy(oy), oz(oz), gridRef(g),
+      cache(std::make_shared<PlaneCache>()), censusRef(&census) {};
 
 int ParentBlock::originX() const { return ox; };
 
@@ -52,11 +205,31 @@ Grid& ParentBlock::grid() { return gridRef; };
 
 const Grid& ParentBlock::grid() const { return gridRef; };
 
+void ParentBlock::invalidate() {
+  cache = std::make_shared<PlaneCache>();
+  censusRef = nullptr;
+}
+
+const BitPlanes& ParentBlock::planes() const {
+  PlaneCache& c = *cache;
+  std::call_once(c.once, [&] { c.planes = std::make_unique<BitPlanes>(gridRef); });
+  return *c.planes;
+}
+
+const Census& ParentBlock::census() const {
+  if (censusRef) return *censusRef;
+  PlaneCache& c = *cache;
+  std::call_once(c.censusOnce, [&] { c.census = std::make_unique<Census>(gridRef); });
+  return *c.census;
+}
+
 void LabelTable::add(char label, const std::string& name) {
   unsigned int key = static_cast<unsigned char>(label);
   if (labelToId[key] == -1) {
     labelToId[key] = static_cast<int>(idToName.size());
+    lut[key] = static_cast<uint16_t>(idToName.size());
     idToName.push_back(name);
+    idToTag.push_back(label);
   }
 }
 
@@ -75,4 +248,104 @@ const std::string& LabelTable::getName(uint32_t id) const {
   throw std::out_of_range("ID out of range");
 }
 
-size_t LabelTable::size() const { return idToName.size(); }
\ No newline at end of file
+char LabelTable::getTag(uint32_t id) const {
+  if (id < idToTag.size()) {
+    return idToTag[id];
+  }
+  throw std::out_of_range("ID out of range");
+}
+
+size_t LabelTable::size() const { return idToName.size(); }
+
+size_t LabelTable::translate(const char* tags, size_t n, uint8_t* ids) const {
+  const unsigned char* t = reinterpret_cast<const unsigned char*>(tags);
+  // Validation is folded into the lookup: every id is OR-ed into 'seen' and
+  // an unknown tag sets bit 8, so the loop itself never branches on errors.
+  uint16_t seen = 0;
+  size_t i = 0;
+
+  // A 256-entry table does not fit a byte shuffle, so the vector part only
+  // detects uniform spans (the common case in block models) and resolves
+  // each of them with a single lookup + fill; mixed spans use the table.
+#if defined(__AVX2__)
+  for (; i + 32 <= n; i += 32) {
+    const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(t + i));
+    const __m256i first = _mm256_set1_epi8(static_cast<char>(t[i]));
+    if (_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, first)) == -1) {
+      const uint16_t id = lut[t[i]];
+      seen |= id;
+      std::memset(ids + i, static_cast<uint8_t>(id), 32);
+    } else {
+      for (size_t k = i; k < i + 32; ++k) {
+        const uint16_t id = lut[t[k]];
+        seen |= id;
+        ids[k] = static_cast<uint8_t>(id);
+      }
+    }
+  }
+#endif
+#if defined(__SSE2__)
+  for (; i + 16 <= n; i += 16) {
+    const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(t + i));
+    const __m128i first = _mm_set1_epi8(static_cast<char>(t[i]));
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(v, first)) == 0xFFFF) {
+      const uint16_t id = lut[t[i]];
+      seen |= id;
+      std::memset(ids + i, static_cast<uint8_t>(id), 16);
+    } else {
+      for (size_t k = i; k < i + 16; ++k) {
+        const uint16_t id = lut[t[k]];
+        seen |= id;
+        ids[k] = static_cast<uint8_t>(id);
+      }
+    }
+  }
+#endif
+  for (; i < n; ++i) {
+    const uint16_t id = lut[t[i]];
+    seen |= id;
+    ids[i] = static_cast<uint8_t>(id);
+  }
+
+  if (!(seen & kUnknownTag)) return n;
+
+  // Failure path only: locate the first bad column
+  for (size_t k = 0; k < n; ++k)
+    if (lut[t[k]] & kUnknownTag) return k;
+  return n;
+}
+
+namespace {
+// OR the low 'width' bits of 'mask' into 'bits' starting at bit i
+inline void orBits(uint64_t* bits, size_t i, uint64_t mask, unsigned width) {
+  const unsigned s = static_cast<unsigned>(i & 63);
+  bits[i >> 6] |= mask << s;
+  if (s + width > 64) bits[(i >> 6) + 1] |= mask >> (64 - s);
+}
+}  // namespace
+
+void Model::runStarts(const uint8_t* ids, size_t n, uint64_t* bits) {
+  std::fill(bits, bits + (n + 63) / 64, 0);
+  if (n == 0) return;
+  bits[0] = 1;
+
+  size_t i = 1;
+#if defined(__AVX2__)
+  for (; i + 32 <= n; i += 32) {
+    const __m256i cur = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(ids + i));
+    const __m256i prev = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(ids + i - 1));
+    const uint32_t same = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(cur, prev)));
+    if (same != 0xFFFFFFFFu) orBits(bits, i, ~same, 32);
+  }
+#endif
+#if defined(__SSE2__)
+  for (; i + 16 <= n; i += 16) {
+    const __m128i cur = _mm_loadu_si128(reinterpret_cast<const __m128i*>(ids + i));
+    const __m128i prev = _mm_loadu_si128(reinterpret_cast<const __m128i*>(ids + i - 1));
+    const uint32_t same = static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(cur, prev)));
+    if (same != 0xFFFFu) orBits(bits, i, ~same & 0xFFFFu, 16);
+  }
+#endif
+  for (; i < n; ++i)
+    if (ids[i] != ids[i - 1]) bits[i >> 6] |= 1ull << (i & 63);
+}
@@ -0,0 +1,246 @@
+#include "../include/Parallel.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <memory>
+
+namespace Parallel {
+
+ThreadPool::ThreadPool(std::size_t threads) {
+  if (threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+  workers_.reserve(threads);
+  for (std::size_t i = 0; i < threads; ++i)
+    workers_.emplace_back(&ThreadPool::workerLoop, this);
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(mtx_);
+    stop_ = true;
+  }
+  cv_.notify_all();
+  for (auto& t : workers_) t.join();
+}
+
+std::size_t ThreadPool::size() const { return workers_.size(); }
+
+void ThreadPool::submit(std::function<void()> task) {
+  {
+    std::lock_guard<std::mutex> lock(mtx_);
+    tasks_.push_back(std::move(task));
+  }
+  cv_.notify_one();
+}
+
+void ThreadPool::workerLoop() {
+  while (true) {
+    std::function<void()> task;
+    {
+      std::unique_lock<std::mutex> lock(mtx_);
+      cv_.wait(lock, [&] { return stop_ || !tasks_.empty(); });
+      if (tasks_.empty()) return;  // stop_ and drained
+      task = std::move(tasks_.front());
+      tasks_.pop_front();
+    }
+    task();
+  }
+}
+
+void ThreadPool::parallelFor(std::size_t n,
+                             const std::function<void(std::size_t)>& fn) {
+  if (n == 0) return;
+  if (n == 1 || workers_.empty()) {
+    for (std::size_t i = 0; i < n; ++i) fn(i);
+    return;
+  }
+
+  // Shared with helper tasks, which may only start after the loop is done
+  struct State {
+    std::atomic<std::size_t> next{0};
+    std::atomic<std::size_t> done{0};
+    std::size_t n{0};
+    const std::function<void(std::size_t)>* fn{nullptr};
+    std::mutex mtx;
+    std::condition_variable cv;
+    std::exception_ptr error;
+  };
+  auto st = std::make_shared<State>();
+  st->n = n;
+  st->fn = &fn;
+
+  auto work = [st]() {
+    std::size_t i;
+    while ((i = st->next.fetch_add(1)) < st->n) {
+      try {
+        (*st->fn)(i);
+      } catch (...) {
+        std::lock_guard<std::mutex> lock(st->mtx);
+        if (!st->error) st->error = std::current_exception();
+      }
+      if (st->done.fetch_add(1) + 1 == st->n) {
+        std::lock_guard<std::mutex> lock(st->mtx);
+        st->cv.notify_all();
+      }
+    }
+  };
+
+  const std::size_t helpers = std::min(workers_.size(), n - 1);
+  for (std::size_t k = 0; k < helpers; ++k) submit(work);
+  work();
+
+  std::unique_lock<std::mutex> lock(st->mtx);
+  st->cv.wait(lock, [&] { return st->done.load() == st->n; });
+  if (st->error) std::rethrow_exception(st->error);
+}
+
+ThreadPool& defaultPool() {
+  static ThreadPool pool;
+  return pool;
+}
+
+namespace {
+// Set on StealingPool threads
+thread_local StealingPool* tlsPool = nullptr;
+thread_local std::size_t tlsQueue = 0;
+}  // namespace
+
+StealingPool::StealingPool(std::size_t threads) {
+  if (threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+  for (std::size_t i = 0; i < threads; ++i)
+    queues_.push_back(std::make_unique<Queue>());
+  workers_.reserve(threads);
+  for (std::size_t i = 0; i < threads; ++i)
+    workers_.emplace_back(&StealingPool::workerLoop, this, i);
+}
+
+StealingPool::~StealingPool() {
+  {
+    std::lock_guard<std::mutex> lock(mtx_);
+    stop_ = true;
+  }
+  cv_.notify_all();
+  for (auto& t : workers_) t.join();
+}
+
+std::size_t StealingPool::size() const { return workers_.size(); }
+
+StealingPool* StealingPool::current() { return tlsPool; }
+
+void StealingPool::push(std::size_t queue, std::function<void()> task) {
+  // Counted before the task is visible so pending_ never underflows; a
+  // thread that sees it early just retries until the task lands
+  pending_.fetch_add(1);
+  {
+    std::lock_guard<std::mutex> qlock(queues_[queue]->mtx);
+    queues_[queue]->tasks.push_back(std::move(task));
+  }
+  // Either a sleeper registered before our increment and is woken here,
+  // or it registers after and sees pending_ > 0 (both are seq_cst)
+  if (sleepers_.load() > 0) {
+    { std::lock_guard<std::mutex> lock(mtx_); }
+    cv_.notify_one();
+  }
+}
+
+void StealingPool::submit(std::function<void()> task) {
+  const std::size_t queue =
+      tlsPool == this ? tlsQueue : nextQueue_.fetch_add(1) % queues_.size();
+  push(queue, std::move(task));
+}
+
+bool StealingPool::runOne(std::size_t self) {
+  std::function<void()> task;
+  for (std::size_t k = 0; k < queues_.size() && !task; ++k) {
+    Queue& q = *queues_[(self + k) % queues_.size()];
+    std::lock_guard<std::mutex> lock(q.mtx);
+    if (q.tasks.empty()) continue;
+    // Own deque: newest first (still in cache); victims: oldest first
+    if (k == 0) {
+      task = std::move(q.tasks.back());
+      q.tasks.pop_back();
+    } else {
+      task = std::move(q.tasks.front());
+      q.tasks.pop_front();
+    }
+  }
+  if (!task) return false;
+  pending_.fetch_sub(1);
+  task();
+  return true;
+}
+
+void StealingPool::workerLoop(std::size_t self) {
+  tlsPool = this;
+  tlsQueue = self;
+  while (true) {
+    if (runOne(self)) continue;
+    std::unique_lock<std::mutex> lock(mtx_);
+    sleepers_.fetch_add(1);
+    cv_.wait(lock, [&] { return stop_ || pending_.load() > 0; });
+    sleepers_.fetch_sub(1);
+    if (stop_ && pending_.load() == 0) return;
+  }
+}
+
+void StealingPool::parallelFor(std::size_t n,
+                               const std::function<void(std::size_t)>& fn) {
+  if (n == 0) return;
+  if (n == 1 || workers_.empty()) {
+    for (std::size_t i = 0; i < n; ++i) fn(i);
+    return;
+  }
+
+  // Iterations are claimed from a shared counter, so the caller only ever
+  // runs this loop's own work; helper tasks may start after it is done
+  struct State {
+    std::atomic<std::size_t> next{0};
+    std::atomic<std::size_t> done{0};
+    std::size_t n{0};
+    const std::function<void(std::size_t)>* fn{nullptr};
+    std::mutex mtx;
+    std::condition_variable cv;
+    std::exception_ptr error;
+  };
+  auto st = std::make_shared<State>();
+  st->n = n;
+  st->fn = &fn;
+
+  auto work = [st]() {
+    std::size_t i;
+    while ((i = st->next.fetch_add(1)) < st->n) {
+      try {
+        (*st->fn)(i);
+      } catch (...) {
+        std::lock_guard<std::mutex> lock(st->mtx);
+        if (!st->error) st->error = std::current_exception();
+      }
+      if (st->done.fetch_add(1) + 1 == st->n) {
+        std::lock_guard<std::mutex> lock(st->mtx);
+        st->cv.notify_all();
+      }
+    }
+  };
+
+  // Helpers go to the caller's deque when it is a pool thread, where idle
+  // threads steal them; the caller works through the rest, then blocks
+  // until iterations claimed elsewhere finish
+  const std::size_t helpers = std::min(workers_.size(), n - 1);
+  for (std::size_t k = 0; k < helpers; ++k) submit(work);
+  work();
+  {
+    std::unique_lock<std::mutex> lock(st->mtx);
+    st->cv.wait(lock, [&] { return st->done.load() == n; });
+  }
+  if (st->error) std::rethrow_exception(st->error);
+}
+
+void parallelFor(std::size_t n, const std::function<void(std::size_t)>& fn) {
+  if (StealingPool* pool = StealingPool::current()) {
+    pool->parallelFor(n, fn);
+  } else {
+    defaultPool().parallelFor(n, fn);
+  }
+}
+
+};  // namespace Parallel
@@ -1,126 +1,332 @@
 #include "../include/Strategy.hpp"
+#include "../include/Parallel.hpp"
+#include <algorithm>
+#include <array>
 #include <functional>
+#include <limits>
+#include <memory>
+#include <tuple>
 
 using Model::BlockDesc;
 using Model::ParentBlock;
 
 namespace {
 
-// Build a binary mask for one z-slice: 1 where cell == labelId, else 0.
-std::vector<uint8_t> buildMaskSlice(const ParentBlock& parent, uint32_t labelId,
-                                    int z) {
-  const int W = parent.sizeX();
-  const int H = parent.sizeY();
-  const size_t N = static_cast<size_t>(W * H);
-  std::vector<uint8_t> mask(N, 0);
+inline int popcount64(uint64_t v) { return __builtin_popcountll(v); }
 
-  for (int y = 0; y < H; ++y) {
-    for (int x = 0; x < W; ++x) {
-      mask[static_cast<size_t>(x + y * W)] =
-          (parent.grid().at(x, y, z) == labelId) ? 1u : 0u;
-    }
+// First x in [from, W) whose bit equals 'set', or W
+inline int nextBit(const uint64_t* row, int from, int W, bool set) {
+  if (from >= W) return W;
+  size_t w = static_cast<size_t>(from) >> 6;
+  uint64_t word = (set ? row[w] : ~row[w]) & (~0ull << (from & 63));
+  while (word == 0) {
+    if (static_cast<int>(++w * 64) >= W) return W;
+    word = set ? row[w] : ~row[w];
   }
-  return mask;
+  return std::min(W, static_cast<int>(w * 64) + __builtin_ctzll(word));
 }
 
-// Merge horizontal runs on a single row into [x0, x1) intervals where mask==1.
-void findRowRuns(const std::vector<uint8_t>& rowMask, int W,
+// Merge horizontal runs on a single plane row into [x0, x1) intervals.
+void findRowRuns(const uint64_t* row, int W,
                  std::vector<std::pair<int, int>>& runs) {
   runs.clear();
-  int x = 0;
+  int x = nextBit(row, 0, W, true);
   while (x < W) {
-    while (x < W && rowMask[static_cast<size_t>(x)] == 0) ++x;
-    if (x >= W) break;
     const int start = x;
-    while (x < W && rowMask[static_cast<size_t>(x)] == 1) ++x;
+    x = nextBit(row, x, W, false);
     runs.emplace_back(start, x);  // [start, x)
+    x = nextBit(row, x, W, true);
+  }
+}
+
+struct RowGroup {
+  int x0, x1, startY, height;
+};
+
+// GreedyStrat row step: a run extends the active group with the same span,
+// otherwise it opens a new group; groups that did not continue are emitted.
+template <typename Emit>
+void greedyRow(const std::vector<std::pair<int, int>>& runs, int y,
+               std::vector<RowGroup>& active, std::vector<RowGroup>& nextActive,
+               Emit&& emit) {
+  nextActive.clear();
+  for (auto [rx0, rx1] : runs) {
+    bool extended = false;
+    for (auto& g : active) {
+      if (g.x0 == rx0 && g.x1 == rx1) {
+        ++g.height;
+        nextActive.push_back(g);
+        extended = true;
+        break;
+      }
+    }
+    if (!extended) {
+      nextActive.push_back(RowGroup{rx0, rx1, y, 1});
+    }
+  }
+  // flush groups that didn't continue
+  for (const auto& g : active) {
+    bool still = false;
+    for (const auto& ng : nextActive) {
+      if (ng.x0 == g.x0 && ng.x1 == g.x1 && ng.startY == g.startY &&
+          ng.height >= g.height) {
+        still = true;
+        break;
+      }
+    }
+    if (!still && g.x1 > g.x0 && g.height > 0) emit(g);
   }
+  active.swap(nextActive);
 }
 
-// Largest rectangle in histogram (classic monotonic stack).
-// Returns (bestArea, bestLeft, bestRightExclusive, bestHeight).
-std::tuple<int, int, int, int> largestRectInHistogram(
-    const std::vector<int>& h) {
-  std::stack<int> st;
-  int bestArea = 0, bestL = 0, bestR = 0, bestH = 0;
-  const int W = static_cast<int>(h.size());
-  for (int i = 0; i <= W; ++i) {
-    const int curH = (i < W) ? h[static_cast<size_t>(i)] : 0;
-    while (!st.empty() && h[static_cast<size_t>(st.top())] > curH) {
-      const int height = h[static_cast<size_t>(st.top())];
-      st.pop();
-      const int left = st.empty() ? 0 : (st.top() + 1);
-      const int right = i;
-      const int area = height * (right - left);
-      if (area > bestArea) {
-        bestArea = area;
-        bestL = left;
-        bestR = right;
-        bestH = height;
+// RLEXYStrat row step. Unlike greedyRow, a run that cannot extend a group
+// also emits every active group it overlaps.
+template <typename Emit>
+void rlexyRow(const std::vector<std::pair<int, int>>& runs, int y,
+              std::vector<RowGroup>& active, std::vector<RowGroup>& nextActive,
+              Emit&& emit) {
+  nextActive.clear();
+
+  // Try to extend active groups
+  for (const auto& run : runs) {
+    bool merged = false;
+    for (auto& g : active) {
+      if (g.x0 == run.first && g.x1 == run.second &&
+          g.startY + g.height == y) {
+        ++g.height;
+        nextActive.push_back(g);
+        merged = true;
+        break;
+      }
+    }
+    if (!merged) {
+      // Emit groups that can't extend
+      for (const auto& g : active) {
+        if ((g.x0 < run.second && g.x1 > run.first)) emit(g);
+      }
+      // Start new group
+      nextActive.push_back(RowGroup{run.first, run.second, y, 1});
+    }
+  }
+
+  // Emit groups that ended
+  for (const auto& g : active) {
+    bool found = false;
+    for (const auto& next : nextActive) {
+      if (next.x0 == g.x0 && next.x1 == g.x1 && next.startY == g.startY) {
+        found = true;
+        break;
       }
     }
-    st.push(i);
+    if (!found) emit(g);
   }
-  return {bestArea, bestL, bestR, bestH};
+
+  active.swap(nextActive);
 }
 
+// Per-label row state for the single-pass coverAll() implementations.
+// Each grid row is split into runs by label change; every label keeps its
+// own groups and output so the result matches the per-label cover() loop.
+// Labels that fill their bounding box skip the pass (see coverTrivial).
+struct LabelRows {
+  struct State {
+    std::vector<std::pair<int, int>> runs;
+    std::vector<RowGroup> active, nextActive;
+    std::vector<BlockDesc> out;
+    bool swept{false};
+  };
+
+  const ParentBlock& parent;
+  std::vector<State> state;
+  std::vector<uint32_t> labels;  // swept by the pass, ascending
+  std::vector<uint8_t> ids;
+  std::vector<uint64_t> starts;  // run boundaries of 'ids'
+
+  explicit LabelRows(const ParentBlock& p)
+      : parent(p),
+        ids(static_cast<size_t>(p.sizeX())),
+        starts((static_cast<size_t>(p.sizeX()) + 63) / 64) {
+    const auto& census = p.census();
+    state.resize(std::max<size_t>(census.labelCount(), 256));
+    for (uint32_t l = 0; l < census.labelCount(); ++l) {
+      const Model::LabelBox& b = census.box(l);
+      if (b.solid()) {
+        state[l].out.push_back(BlockDesc{p.originX() + b.x0, p.originY() + b.y0,
+                                         p.originZ() + b.z0, b.x1 - b.x0,
+                                         b.y1 - b.y0, b.z1 - b.z0, l});
+      } else if (b.count > 0) {
+        labels.push_back(l);
+        state[l].swept = true;
+      }
+    }
+  }
+
+  void splitRow(int y, int z, int W) {
+    for (uint32_t l : labels) state[l].runs.clear();
+    parent.grid().copyRow(y, z, ids.data());
+    Model::runStarts(ids.data(), static_cast<size_t>(W), starts.data());
+    int x = 0;
+    while (x < W) {
+      const uint8_t id = ids[static_cast<size_t>(x)];
+      const int next = nextBit(starts.data(), x + 1, W, true);
+      if (state[id].swept) state[id].runs.emplace_back(x, next);
+      x = next;
+    }
+  }
+
+  void drain(std::vector<BlockDesc>& out) {
+    for (const State& st : state)
+      out.insert(out.end(), st.out.begin(), st.out.end());
+  }
+};
+
 struct Rect2D {
   int x, y, w, h;
 };
 
-// Find best area rectangle in a W×H mask via histogram scan.
-std::pair<int, Rect2D> findBestRect2D(const std::vector<uint8_t>& mask, int W,
-                                      int H) {
-  std::vector<int> heights(static_cast<size_t>(W), 0);
-  int bestArea = 0;
-  Rect2D best{0, 0, 0, 0};
-  for (int y = 0; y < H; ++y) {
-    for (int x = 0; x < W; ++x) {
-      heights[static_cast<size_t>(x)] =
-          (mask[static_cast<size_t>(x + y * W)] != 0)
-              ? heights[static_cast<size_t>(x)] + 1
-              : 0;
+// Incremental MaxRect slice cover. Keeps the column-height histogram of
+// every row and each row's best rectangle (first maximum found by the
+// monotonic-stack scan). Erasing a rectangle recomputes only the rows
+// whose heights changed, and a tournament tree over rows picks the first
+// row with the largest area - the same rectangle a full rescan would.
+// Buffers are kept between slices; use one engine per thread.
+class MaxRectCover {
+ public:
+  // Load slice z of the label's mask
+  void reset(const ParentBlock& parent, uint32_t labelId, int z) {
+    W_ = parent.sizeX();
+    H_ = parent.sizeY();
+    const size_t n = static_cast<size_t>(W_) * H_;
+    mask_.resize(n);
+    heights_.resize(n);
+    best_.resize(static_cast<size_t>(H_));
+    stack_.resize(static_cast<size_t>(W_) + 1);
+    ones_ = 0;
+
+    const auto& planes = parent.planes();
+    for (int y = 0; y < H_; ++y) {
+      const uint64_t* bits = planes.row(labelId, y, z);
+      uint8_t* m = &mask_[static_cast<size_t>(y) * W_];
+      for (int x = 0; x < W_; ++x)
+        m[x] = static_cast<uint8_t>((bits[x >> 6] >> (x & 63)) & 1u);
     }
-    auto [area, l, r, h] = largestRectInHistogram(heights);
-    if (area > bestArea && (r - l) > 0 && h > 0) {
-      bestArea = area;
-      best = Rect2D{l, y - h + 1, r - l, h};
+
+    for (int y = 0; y < H_; ++y) {
+      const uint8_t* m = &mask_[static_cast<size_t>(y) * W_];
+      int* h = &heights_[static_cast<size_t>(y) * W_];
+      const int* up = y > 0 ? h - W_ : nullptr;
+      for (int x = 0; x < W_; ++x) {
+        h[x] = m[x] ? (up ? up[x] : 0) + 1 : 0;
+        ones_ += m[x] != 0;
+      }
+      scanRow(y);
     }
+    leaves_ = 1;
+    while (leaves_ < H_) leaves_ <<= 1;
+    tree_.assign(static_cast<size_t>(2 * leaves_), -1);
+    for (int y = 0; y < H_; ++y) tree_[static_cast<size_t>(leaves_ + y)] = y;
+    for (int i = leaves_ - 1; i >= 1; --i) pull(i);
   }
-  return {bestArea, best};
-}
 
-void eraseRect(std::vector<uint8_t>& mask, int W, const Rect2D& r) {
-  for (int yy = r.y; yy < r.y + r.h; ++yy) {
-    uint8_t* row = &mask[static_cast<size_t>(yy * W)];
-    std::fill(row + r.x, row + r.x + r.w, 0u);
+  // Cover the loaded slice, replacing the contents of 'rects'
+  void run(std::vector<Rect2D>& rects) {
+    rects.clear();
+    while (ones_ > 0) {
+      const int y = H_ > 0 ? tree_[1] : -1;
+      if (y < 0 || best_[static_cast<size_t>(y)].area <= 0) {
+        for (int yy = 0; yy < H_; ++yy)
+          for (int x = 0; x < W_; ++x)
+            if (mask_[static_cast<size_t>(x + yy * W_)])
+              rects.push_back(Rect2D{x, yy, 1, 1});
+        break;
+      }
+      const RowBest& b = best_[static_cast<size_t>(y)];
+      const Rect2D r{b.l, y - b.h + 1, b.r - b.l, b.h};
+      rects.push_back(r);
+      erase(r);
+    }
   }
-}
 
-std::vector<Rect2D> coverSliceWithMaxRects(std::vector<uint8_t> mask, int W,
-                                           int H) {
-  std::vector<Rect2D> rects;
-
-  auto anyOne = [&]() {
-    for (uint8_t v : mask)
-      if (v) return true;
-    return false;
+ private:
+  struct RowBest {
+    int area{0}, l{0}, r{0}, h{0};
   };
 
-  while (anyOne()) {
-    auto [area, best] = findBestRect2D(mask, W, H);
-    if (area <= 0 || best.w <= 0 || best.h <= 0) {
-      for (int y = 0; y < H; ++y)
-        for (int x = 0; x < W; ++x)
-          if (mask[static_cast<size_t>(x + y * W)])
-            rects.push_back(Rect2D{x, y, 1, 1});
-      break;
+  int W_{0}, H_{0};
+  std::vector<uint8_t> mask_;
+  std::vector<int> heights_;
+  std::vector<RowBest> best_;
+  std::vector<int> stack_;
+  std::vector<int> tree_;
+  int leaves_{1};
+  size_t ones_{0};
+
+  // Largest rectangle in row y's histogram (classic monotonic stack);
+  // pops on strictly greater heights and keeps the first maximum.
+  void scanRow(int y) {
+    const int* h = &heights_[static_cast<size_t>(y) * W_];
+    int top = 0;
+    RowBest best;
+    for (int i = 0; i <= W_; ++i) {
+      const int curH = (i < W_) ? h[i] : 0;
+      while (top > 0 && h[stack_[top - 1]] > curH) {
+        const int height = h[stack_[--top]];
+        const int left = top == 0 ? 0 : (stack_[top - 1] + 1);
+        const int area = height * (i - left);
+        if (area > best.area) best = RowBest{area, left, i, height};
+      }
+      if (i < W_) stack_[top++] = i;
+    }
+    best_[static_cast<size_t>(y)] = best;
+  }
+
+  // Larger area wins; ties go to the earlier row
+  int better(int a, int b) const {
+    if (a < 0) return b;
+    if (b < 0) return a;
+    const int aa = best_[static_cast<size_t>(a)].area;
+    const int ba = best_[static_cast<size_t>(b)].area;
+    if (aa != ba) return aa > ba ? a : b;
+    return std::min(a, b);
+  }
+
+  void pull(int i) {
+    tree_[static_cast<size_t>(i)] = better(tree_[static_cast<size_t>(2 * i)],
+                                           tree_[static_cast<size_t>(2 * i + 1)]);
+  }
+
+  void erase(const Rect2D& r) {
+    for (int yy = r.y; yy < r.y + r.h; ++yy) {
+      uint8_t* row = &mask_[static_cast<size_t>(yy * W_)];
+      std::fill(row + r.x, row + r.x + r.w, 0u);
+    }
+    ones_ -= static_cast<size_t>(r.w) * r.h;
+
+    // Heights change from r.y down each erased column until they agree
+    // with the old values again
+    int last = r.y + r.h - 1;
+    for (int x = r.x; x < r.x + r.w; ++x) {
+      for (int y = r.y; y < H_; ++y) {
+        const size_t i = static_cast<size_t>(y) * W_ + x;
+        const int h = mask_[i] ? (y > 0 ? heights_[i - W_] : 0) + 1 : 0;
+        if (h == heights_[i] && y >= r.y + r.h) break;
+        heights_[i] = h;
+        last = std::max(last, y);
+      }
+    }
+    for (int y = r.y; y <= last; ++y) {
+      scanRow(y);
+      for (int i = (leaves_ + y) / 2; i >= 1; i /= 2) pull(i);
     }
-    rects.push_back(best);
-    eraseRect(mask, W, best);
   }
+};
 
-  return rects;
+// MaxRect cover of slice z of the label, on this thread's engine
+void coverSliceWithMaxRects(const ParentBlock& parent, uint32_t labelId, int z,
+                            std::vector<Rect2D>& rects) {
+  thread_local MaxRectCover engine;
+  engine.reset(parent, labelId, z);
+  engine.run(rects);
 }
 
 uint64_t rectKey(int x, int y, int w, int h) {
@@ -134,198 +340,342 @@ struct Active3D {
   int x, y, w, h, startZ, dz;
 };
 
+// Start and extent of a block along axis 0 (x), 1 (y) or 2 (z)
+inline int& axisStart(BlockDesc& b, int axis) {
+  return axis == 0 ? b.x : axis == 1 ? b.y : b.z;
+}
+inline int& axisSize(BlockDesc& b, int axis) {
+  return axis == 0 ? b.dx : axis == 1 ? b.dy : b.dz;
+}
+
+// The face a block presents along one axis: its position on that axis plus
+// the start and extent on the other two. Two blocks merge along the axis
+// when one's far face key equals the other's near face key.
+struct FaceKey {
+  uint32_t labelId;
+  int pos, u, v, du, dv;
+
+  bool operator==(const FaceKey& o) const {
+    return labelId == o.labelId && pos == o.pos && u == o.u && v == o.v &&
+           du == o.du && dv == o.dv;
+  }
+};
+
+struct FaceKeyHash {
+  size_t operator()(const FaceKey& k) const {
+    uint64_t h = k.labelId;
+    for (int f : {k.pos, k.u, k.v, k.du, k.dv})
+      h = (h ^ static_cast<uint32_t>(f)) * 0x9E3779B97F4A7C15ull;
+    return static_cast<size_t>(h ^ (h >> 32));
+  }
+};
+
+FaceKey faceKey(BlockDesc b, int axis, int pos) {
+  const int a = (axis + 1) % 3, c = (axis + 2) % 3;
+  return FaceKey{b.labelId,         pos,
+                 axisStart(b, a),   axisStart(b, c),
+                 axisSize(b, a),    axisSize(b, c)};
+}
+
+// Open-addressing index from near-face key to block, for one axis. Slots
+// hold block indices and keys are recomputed from the blocks, so a rebuild
+// allocates nothing once the table has grown.
+class FaceTable {
+ private:
+  static constexpr uint32_t kEmpty = std::numeric_limits<uint32_t>::max();
+  std::vector<uint32_t> slots_;
+  size_t mask_{0};
+
+ public:
+  static constexpr uint32_t kNone = kEmpty;
+
+  void build(std::vector<BlockDesc>& blocks, int axis) {
+    size_t cap = 16;
+    while (cap < blocks.size() * 2) cap <<= 1;
+    slots_.assign(cap, kEmpty);
+    mask_ = cap - 1;
+    for (uint32_t i = 0; i < blocks.size(); ++i) {
+      const FaceKey k = faceKey(blocks[i], axis, axisStart(blocks[i], axis));
+      size_t s = FaceKeyHash()(k) & mask_;
+      // First block wins on duplicate keys
+      while (slots_[s] != kEmpty &&
+             !(faceKey(blocks[slots_[s]], axis,
+                       axisStart(blocks[slots_[s]], axis)) == k))
+        s = (s + 1) & mask_;
+      if (slots_[s] == kEmpty) slots_[s] = i;
+    }
+  }
+
+  uint32_t find(std::vector<BlockDesc>& blocks, int axis,
+                const FaceKey& k) const {
+    for (size_t s = FaceKeyHash()(k) & mask_; slots_[s] != kEmpty;
+         s = (s + 1) & mask_) {
+      BlockDesc& b = blocks[slots_[s]];
+      if (faceKey(b, axis, axisStart(b, axis)) == k) return slots_[s];
+    }
+    return kNone;
+  }
+};
+
 }  // namespace
 
 namespace Strategy {
 
 // DefaultStrat: emit 1×1×1 per matching cell
-std::vector<BlockDesc> DefaultStrat::cover(const ParentBlock& parent,
-                                           uint32_t labelId) {
+std::vector<BlockDesc> DefaultStrat::coverLabel(const ParentBlock& parent,
+                                                uint32_t labelId) {
   std::vector<BlockDesc> out;
   const int W = parent.sizeX(), H = parent.sizeY(), D = parent.sizeZ();
   const int ox = parent.originX(), oy = parent.originY(), oz = parent.originZ();
 
+  const auto& planes = parent.planes();
   out.reserve(static_cast<size_t>(W) * H * D);
   for (int z = 0; z < D; ++z)
-    for (int y = 0; y < H; ++y)
-      for (int x = 0; x < W; ++x)
-        if (parent.grid().at(x, y, z) == labelId)
+    for (int y = 0; y < H; ++y) {
+      const uint64_t* bits = planes.row(labelId, y, z);
+      for (size_t w = 0; w < planes.wordsPerRow(); ++w)
+        for (uint64_t word = bits[w]; word; word &= word - 1) {
+          const int x = static_cast<int>(w * 64) + __builtin_ctzll(word);
           out.push_back(BlockDesc{ox + x, oy + y, oz + z, 1, 1, 1, labelId});
+        }
+    }
   return out;
 }
 
-// GreedyStrat: row runs + vertical merge (dz=1)
-std::vector<BlockDesc> GreedyStrat::cover(const ParentBlock& parent,
-                                          uint32_t labelId) {
+size_t coverLowerBound(const ParentBlock& parent, uint32_t labelId) {
+  const int H = parent.sizeY(), D = parent.sizeZ();
+  const auto& planes = parent.planes();
+  const size_t words = planes.wordsPerRow();
+
+  // Forced corners: for each cell, (empty x sides) * (empty y sides) in the
+  // slice, times (empty z sides) across slices
+  uint64_t corners3 = 0, sliceBound = 0;
+  for (int z = 0; z < D; ++z) {
+    uint64_t corners2 = 0;
+    for (int y = 0; y < H; ++y) {
+      const uint64_t* b = planes.row(labelId, y, z);
+      const uint64_t* ym = y > 0 ? planes.row(labelId, y - 1, z) : nullptr;
+      const uint64_t* yp = y + 1 < H ? planes.row(labelId, y + 1, z) : nullptr;
+      const uint64_t* zm = z > 0 ? planes.row(labelId, y, z - 1) : nullptr;
+      const uint64_t* zp = z + 1 < D ? planes.row(labelId, y, z + 1) : nullptr;
+      for (size_t w = 0; w < words; ++w) {
+        const uint64_t c = b[w];
+        if (!c) continue;
+        // Neighbour at x-1 / x+1, carrying across words
+        const uint64_t prev = (c << 1) | (w > 0 ? b[w - 1] >> 63 : 0);
+        const uint64_t next = (c >> 1) | (w + 1 < words ? b[w + 1] << 63 : 0);
+        const uint64_t xs[2] = {c & ~prev, c & ~next};
+        const uint64_t ys[2] = {c & ~(ym ? ym[w] : 0), c & ~(yp ? yp[w] : 0)};
+        const uint64_t zs[2] = {c & ~(zm ? zm[w] : 0), c & ~(zp ? zp[w] : 0)};
+        for (uint64_t x : xs)
+          for (uint64_t yy : ys) {
+            const uint64_t xy = x & yy;
+            corners2 += popcount64(xy);
+            corners3 += popcount64(xy & zs[0]) + popcount64(xy & zs[1]);
+          }
+      }
+    }
+    sliceBound = std::max(sliceBound, (corners2 + 3) / 4);
+  }
+  return static_cast<size_t>(std::max((corners3 + 7) / 8, sliceBound));
+}
+
+bool GroupingStrategy::coverTrivial(const ParentBlock& parent,
+                                    uint32_t labelId,
+                                    std::vector<BlockDesc>& out) {
+  const Model::LabelBox& b = parent.census().box(labelId);
+  if (b.count == 0) return true;
+  if (!b.solid()) return false;
+  out.push_back(BlockDesc{parent.originX() + b.x0, parent.originY() + b.y0,
+                          parent.originZ() + b.z0, b.x1 - b.x0, b.y1 - b.y0,
+                          b.z1 - b.z0, labelId});
+  return true;
+}
+
+std::vector<BlockDesc> GroupingStrategy::coverLabel(const ParentBlock& parent,
+                                                    uint32_t labelId) {
+  std::vector<BlockDesc> out;
+  coverLabel(parent, labelId, out);
+  return out;
+}
+
+void GroupingStrategy::coverLabel(const ParentBlock& parent, uint32_t labelId,
+                                  std::vector<BlockDesc>& out) {
+  out = coverLabel(parent, labelId);
+}
+
+std::vector<BlockDesc> GroupingStrategy::cover(const ParentBlock& parent,
+                                               uint32_t labelId) {
   std::vector<BlockDesc> out;
+  cover(parent, labelId, out);
+  return out;
+}
+
+void GroupingStrategy::cover(const ParentBlock& parent, uint32_t labelId,
+                             std::vector<BlockDesc>& out) {
+  out.clear();
+  if (coverTrivial(parent, labelId, out)) return;
+
+  const Model::LabelBox& b = parent.census().box(labelId);
+  if (!cropsToLabel() ||
+      (b.x0 == 0 && b.y0 == 0 && b.z0 == 0 && b.x1 == parent.sizeX() &&
+       b.y1 == parent.sizeY() && b.z1 == parent.sizeZ())) {
+    coverLabel(parent, labelId, out);
+    return;
+  }
+
+  // Crop to the bounding box; the crop's origin keeps blocks global
+  const Model::Grid& src = parent.grid();
+  Model::Grid crop(b.x1 - b.x0, b.y1 - b.y0, b.z1 - b.z0, src.cellWidth());
+  std::vector<uint8_t> row(static_cast<size_t>(parent.sizeX()));
+  for (int z = b.z0; z < b.z1; ++z)
+    for (int y = b.y0; y < b.y1; ++y) {
+      src.copyRow(y, z, row.data());
+      crop.setRow(0, y - b.y0, z - b.z0, row.data() + b.x0,
+                  static_cast<size_t>(b.x1 - b.x0));
+    }
+  coverLabel(ParentBlock(parent.originX() + b.x0, parent.originY() + b.y0,
+                         parent.originZ() + b.z0, crop),
+             labelId, out);
+}
+
+void GroupingStrategy::coverAll(const ParentBlock& parent,
+                                std::vector<BlockDesc>& out) {
+  const auto& census = parent.census();
+  for (uint32_t labelId = 0; labelId < census.labelCount(); ++labelId) {
+    if (!census.contains(labelId)) continue;
+    std::vector<BlockDesc> blocks = cover(parent, labelId);
+    out.insert(out.end(), blocks.begin(), blocks.end());
+  }
+}
+
+// GreedyStrat: row runs + vertical merge (dz=1)
+void GreedyStrat::coverLabel(const ParentBlock& parent, uint32_t labelId,
+                             std::vector<BlockDesc>& out) {
+  out.clear();
   const int W = parent.sizeX(), H = parent.sizeY(), D = parent.sizeZ();
   const int ox = parent.originX(), oy = parent.originY(), oz = parent.originZ();
 
-  std::vector<uint8_t> rowMask(static_cast<size_t>(W), 0);
-  std::vector<std::pair<int, int>> currRuns, prevRuns;
-
-  struct Group {
-    int x0, x1, startY, height;
-  };
-  std::vector<Group> active, nextActive;
+  const auto& planes = parent.planes();
+  std::vector<std::pair<int, int>> currRuns;
+  std::vector<RowGroup> active, nextActive;
 
   for (int z = 0; z < D; ++z) {
+    auto emit = [&](const RowGroup& g) {
+      out.push_back(BlockDesc{ox + g.x0, oy + g.startY, oz + z, g.x1 - g.x0,
+                              g.height, 1, labelId});
+    };
     active.clear();
     for (int y = 0; y < H; ++y) {
-      for (int x = 0; x < W; ++x)
-        rowMask[static_cast<size_t>(x)] =
-            (parent.grid().at(x, y, z) == labelId) ? 1u : 0u;
-
-      currRuns.clear();
-      findRowRuns(rowMask, W, currRuns);
-
-      nextActive.clear();
-      for (auto [rx0, rx1] : currRuns) {
-        bool extended = false;
-        for (auto& g : active) {
-          if (g.x0 == rx0 && g.x1 == rx1) {
-            ++g.height;
-            nextActive.push_back(g);
-            extended = true;
-            break;
-          }
-        }
-        if (!extended) {
-          nextActive.push_back(Group{rx0, rx1, y, 1});
-        }
-      }
-      // flush groups that didn't continue
-      for (const auto& g : active) {
-        bool still = false;
-        for (const auto& ng : nextActive) {
-          if (ng.x0 == g.x0 && ng.x1 == g.x1 && ng.startY == g.startY &&
-              ng.height >= g.height) {
-            still = true;
-            break;
-          }
-        }
-        if (!still) {
-          const int dx = g.x1 - g.x0;
-          if (dx > 0 && g.height > 0)
-            out.push_back(BlockDesc{ox + g.x0, oy + g.startY, oz + z, dx,
-                                    g.height, 1, labelId});
-        }
-      }
-      active.swap(nextActive);
+      findRowRuns(planes.row(labelId, y, z), W, currRuns);
+      greedyRow(currRuns, y, active, nextActive, emit);
     }
     // flush remaining
-    for (const auto& g : active) {
-      const int dx = g.x1 - g.x0;
-      if (dx > 0 && g.height > 0)
-        out.push_back(BlockDesc{ox + g.x0, oy + g.startY, oz + z, dx, g.height,
-                                1, labelId});
+    for (const auto& g : active) emit(g);
+  }
+}
+
+void GreedyStrat::coverAll(const ParentBlock& parent,
+                           std::vector<BlockDesc>& out) {
+  const int W = parent.sizeX(), H = parent.sizeY(), D = parent.sizeZ();
+  const int ox = parent.originX(), oy = parent.originY(), oz = parent.originZ();
+
+  LabelRows rows(parent);
+  for (int z = 0; z < D; ++z) {
+    for (uint32_t l : rows.labels) rows.state[l].active.clear();
+    for (int y = 0; y < H; ++y) {
+      rows.splitRow(y, z, W);
+      for (uint32_t l : rows.labels) {
+        auto& st = rows.state[l];
+        greedyRow(st.runs, y, st.active, st.nextActive, [&](const RowGroup& g) {
+          st.out.push_back(BlockDesc{ox + g.x0, oy + g.startY, oz + z,
+                                     g.x1 - g.x0, g.height, 1, l});
+        });
+      }
+    }
+    for (uint32_t l : rows.labels) {
+      auto& st = rows.state[l];
+      for (const auto& g : st.active)
+        st.out.push_back(BlockDesc{ox + g.x0, oy + g.startY, oz + z,
+                                   g.x1 - g.x0, g.height, 1, l});
     }
   }
-  return out;
+  rows.drain(out);
 }
 
 // RLEXYStrat: RLE along X + vertical merge within parent block
-std::vector<BlockDesc> RLEXYStrat::cover(const ParentBlock& parent,
-                                          uint32_t labelId) {
+std::vector<BlockDesc> RLEXYStrat::coverLabel(const ParentBlock& parent,
+                                              uint32_t labelId) {
   std::vector<BlockDesc> out;
 
   const int W = parent.sizeX(), H = parent.sizeY(), D = parent.sizeZ();
   const int ox = parent.originX(), oy = parent.originY(), oz = parent.originZ();
 
+  const auto& planes = parent.planes();
+  std::vector<std::pair<int, int>> runs;
+  std::vector<RowGroup> active, nextActive;
+
   // Process each slice independently (dz=1 per block)
   for (int z = 0; z < D; ++z) {
-    // Build binary mask for this slice
-    std::vector<uint8_t> mask = buildMaskSlice(parent, labelId, z);
-
-    // Current active groups (x0, x1, startY, height)
-    struct Group {
-      int x0, x1, startY, height;
+    auto emit = [&](const RowGroup& g) {
+      out.push_back(BlockDesc{ox + g.x0, oy + g.startY, oz + z, g.x1 - g.x0,
+                              g.height, 1, labelId});
     };
-    std::vector<Group> active;
-    std::vector<Group> nextActive;
-
-    // Process each row
+    active.clear();
     for (int y = 0; y < H; ++y) {
-      nextActive.clear();
-
       // Find runs in this row
-      std::vector<std::pair<int, int>> runs;
-      int x = 0;
-      while (x < W) {
-        while (x < W && mask[static_cast<size_t>(x + y * W)] == 0) ++x;
-        if (x >= W) break;
-        const int start = x;
-        while (x < W && mask[static_cast<size_t>(x + y * W)] == 1) ++x;
-        runs.emplace_back(start, x);
-      }
-
-      // Try to extend active groups
-      for (const auto& run : runs) {
-        bool merged = false;
-        for (auto& g : active) {
-          if (g.x0 == run.first && g.x1 == run.second &&
-              g.startY + g.height == y) {
-            ++g.height;
-            nextActive.push_back(g);
-            merged = true;
-            break;
-          }
-        }
-        if (!merged) {
-          // Emit groups that can't extend
-          for (const auto& g : active) {
-            if ((g.x0 < run.second && g.x1 > run.first)) {
-              out.push_back(BlockDesc{ox + g.x0, oy + g.startY, oz + z,
-                                      g.x1 - g.x0, g.height, 1, labelId});
-            }
-          }
-          // Start new group
-          nextActive.push_back(Group{run.first, run.second, y, 1});
-        }
-      }
-
-      // Emit groups that ended
-      for (const auto& g : active) {
-        bool found = false;
-        for (const auto& next : nextActive) {
-          if (next.x0 == g.x0 && next.x1 == g.x1 && next.startY == g.startY) {
-            found = true;
-            break;
-          }
-        }
-        if (!found) {
-          out.push_back(BlockDesc{ox + g.x0, oy + g.startY, oz + z,
-                                  g.x1 - g.x0, g.height, 1, labelId});
-        }
-      }
-
-      active.swap(nextActive);
+      findRowRuns(planes.row(labelId, y, z), W, runs);
+      rlexyRow(runs, y, active, nextActive, emit);
     }
 
     // Flush remaining groups
-    for (const auto& g : active) {
-      out.push_back(BlockDesc{ox + g.x0, oy + g.startY, oz + z,
-                              g.x1 - g.x0, g.height, 1, labelId});
-    }
+    for (const auto& g : active) emit(g);
   }
 
   return out;
 }
 
+void RLEXYStrat::coverAll(const ParentBlock& parent,
+                          std::vector<BlockDesc>& out) {
+  const int W = parent.sizeX(), H = parent.sizeY(), D = parent.sizeZ();
+  const int ox = parent.originX(), oy = parent.originY(), oz = parent.originZ();
+
+  LabelRows rows(parent);
+  for (int z = 0; z < D; ++z) {
+    for (uint32_t l : rows.labels) rows.state[l].active.clear();
+    for (int y = 0; y < H; ++y) {
+      rows.splitRow(y, z, W);
+      for (uint32_t l : rows.labels) {
+        auto& st = rows.state[l];
+        rlexyRow(st.runs, y, st.active, st.nextActive, [&](const RowGroup& g) {
+          st.out.push_back(BlockDesc{ox + g.x0, oy + g.startY, oz + z,
+                                     g.x1 - g.x0, g.height, 1, l});
+        });
+      }
+    }
+    for (uint32_t l : rows.labels) {
+      auto& st = rows.state[l];
+      for (const auto& g : st.active)
+        st.out.push_back(BlockDesc{ox + g.x0, oy + g.startY, oz + z,
+                                   g.x1 - g.x0, g.height, 1, l});
+    }
+  }
+  rows.drain(out);
+}
+
 // MaxRectStrat: 2D MaxRect per slice + z stacking
-std::vector<BlockDesc> MaxRectStrat::cover(const ParentBlock& parent,
-                                           uint32_t labelId) {
-  std::vector<BlockDesc> out;
+void MaxRectStrat::coverLabel(const ParentBlock& parent, uint32_t labelId,
+                              std::vector<BlockDesc>& out) {
+  out.clear();
 
-  const int W = parent.sizeX(), H = parent.sizeY(), D = parent.sizeZ();
+  const int D = parent.sizeZ();
   const int ox = parent.originX(), oy = parent.originY(), oz = parent.originZ();
 
   std::unordered_map<uint64_t, Active3D> active;
+  std::vector<Rect2D> rects;
 
   for (int z = 0; z < D; ++z) {
-    std::vector<uint8_t> mask = buildMaskSlice(parent, labelId, z);
-
-    std::vector<Rect2D> rects = coverSliceWithMaxRects(std::move(mask), W, H);
+    coverSliceWithMaxRects(parent, labelId, z, rects);
 
     std::unordered_map<uint64_t, Active3D> next;
     next.reserve(rects.size());
@@ -357,23 +707,21 @@ std::vector<BlockDesc> MaxRectStrat::cover(const ParentBlock& parent,
     out.push_back(
         BlockDesc{ox + a.x, oy + a.y, oz + a.startZ, a.w, a.h, a.dz, labelId});
   }
-
-  return out;
 }
 
-std::vector<BlockDesc> Optimal3DStrat::cover(const ParentBlock& parent,
-                                              uint32_t labelId) {
-  std::vector<BlockDesc> out;
+void Optimal3DStrat::coverLabel(const ParentBlock& parent, uint32_t labelId,
+                                std::vector<BlockDesc>& out) {
+  out.clear();
 
-  const int W = parent.sizeX(), H = parent.sizeY(), D = parent.sizeZ();
+  const int D = parent.sizeZ();
   const int ox = parent.originX(), oy = parent.originY(), oz = parent.originZ();
 
   // Use the same MaxRect approach but with enhanced merging
   std::unordered_map<uint64_t, Active3D> active;
+  std::vector<Rect2D> rects;
 
   for (int z = 0; z < D; ++z) {
-    std::vector<uint8_t> mask = buildMaskSlice(parent, labelId, z);
-    std::vector<Rect2D> rects = coverSliceWithMaxRects(std::move(mask), W, H);
+    coverSliceWithMaxRects(parent, labelId, z, rects);
 
     std::unordered_map<uint64_t, Active3D> next;
     next.reserve(rects.size());
@@ -410,144 +758,170 @@ std::vector<BlockDesc> Optimal3DStrat::cover(const ParentBlock& parent,
     out.push_back(
         BlockDesc{ox + a.x, oy + a.y, oz + a.startZ, a.w, a.h, a.dz, labelId});
   }
-
-  return out;
 }
 
-std::vector<BlockDesc> SmartMergeStrat::cover(const ParentBlock& parent,
-                                                uint32_t labelId) {
-  // SmartMergeStrat: Try top 5 most promising strategies and pick the best
-  // Optimized to balance compression quality with speed
-
-  // Approach 1: Optimal3D (enhanced Z-stacking) - Usually wins
-  Optimal3DStrat optimal3d;
-  std::vector<BlockDesc> optimal3dBlocks = optimal3d.cover(parent, labelId);
-
-  // Approach 2: LayeredSlice (Z-first for layered data)
-  LayeredSliceStrat layered;
-  std::vector<BlockDesc> layeredBlocks = layered.cover(parent, labelId);
+SmartMergeStrat::SmartMergeStrat(double tolerance) : tolerance_(tolerance) {}
 
-  // Approach 3: MaxRect (best for large uniform regions)
-  MaxRectStrat maxRect;
-  std::vector<BlockDesc> maxRectBlocks = maxRect.cover(parent, labelId);
-
-  // Approach 4: Greedy (fast fallback)
-  GreedyStrat greedy;
-  std::vector<BlockDesc> greedyBlocks = greedy.cover(parent, labelId);
-
-  // Approach 5: Scanline (good for Manhattan structures)
-  ScanlineStrat scanline;
-  std::vector<BlockDesc> scanlineBlocks = scanline.cover(parent, labelId);
-
-  // Pick the approach with fewest blocks (best compression)
-  size_t minBlocks = optimal3dBlocks.size();
-  std::vector<BlockDesc> best = std::move(optimal3dBlocks);
+SmartMergeStrat::Stats SmartMergeStrat::stats() const {
+  Stats s;
+  s.labels = labels_.load();
+  s.lowerBound = lowerBound_.load();
+  s.blocks = blocks_.load();
+  s.earlyExits = earlyExits_.load();
+  s.skipped = skipped_.load();
+  return s;
+}
 
-  if (layeredBlocks.size() < minBlocks) {
-    minBlocks = layeredBlocks.size();
-    best = std::move(layeredBlocks);
+namespace {
+// SmartMerge candidate result buffers, reused across labels. A thread may
+// cover another label while it waits on a parallel loop, so each nesting
+// level gets its own set.
+struct CandidateScratch {
+  std::array<std::vector<BlockDesc>, 5> results;
+};
+thread_local std::vector<std::unique_ptr<CandidateScratch>> tlsScratch;
+thread_local size_t tlsScratchDepth = 0;
+
+struct ScratchLease {
+  CandidateScratch& scratch;
+  ScratchLease()
+      : scratch(tlsScratchDepth < tlsScratch.size()
+                    ? *tlsScratch[tlsScratchDepth]
+                    : *tlsScratch.emplace_back(
+                          std::make_unique<CandidateScratch>())) {
+    ++tlsScratchDepth;
   }
+  ~ScratchLease() { --tlsScratchDepth; }
+  ScratchLease(const ScratchLease&) = delete;
+  ScratchLease& operator=(const ScratchLease&) = delete;
+};
+}  // namespace
 
-  if (maxRectBlocks.size() < minBlocks) {
-    minBlocks = maxRectBlocks.size();
-    best = std::move(maxRectBlocks);
-  }
+void SmartMergeStrat::coverLabel(const ParentBlock& parent, uint32_t labelId,
+                                 std::vector<BlockDesc>& out) {
+  // SmartMergeStrat: Try top 5 most promising strategies and pick the best
+  // Optimized to balance compression quality with speed. The candidates
+  // keep no per-call state, so one instance of each is shared.
+  static GreedyStrat greedy;         // fast fallback
+  static ScanlineStrat scanline;     // good for Manhattan structures
+  static Optimal3DStrat optimal3d;   // enhanced Z-stacking - usually wins
+  static LayeredSliceStrat layered;  // Z-first for layered data
+  static MaxRectStrat maxRect;       // best for large uniform regions
+
+  // Cheapest first: among good-enough covers the cheapest wins
+  static const std::array<GroupingStrategy*, 5> candidates = {
+      &greedy, &scanline, &optimal3d, &layered, &maxRect};
+  constexpr size_t kNone = candidates.size();
+  ScratchLease lease;
+  auto& results = lease.scratch.results;
+  std::array<bool, 5> ran{};
+
+  const size_t bound = coverLowerBound(parent, labelId);
+  const size_t good = bound + static_cast<size_t>(bound * tolerance_);
+
+  // Lowest candidate index whose cover is good enough. Only candidates
+  // after it are skipped, so the choice does not depend on scheduling.
+  std::atomic<size_t> settled{kNone};
+  auto run = [&](size_t i) {
+    if (settled.load() < i) return;
+    candidates[i]->cover(parent, labelId, results[i]);
+    ran[i] = true;
+    if (results[i].size() > good) return;
+    size_t cur = settled.load();
+    while (i < cur && !settled.compare_exchange_weak(cur, i)) {
+    }
+  };
 
-  if (greedyBlocks.size() < minBlocks) {
-    minBlocks = greedyBlocks.size();
-    best = std::move(greedyBlocks);
+  // Greedy alone settles most labels; the rest are independent and only
+  // read the parent, so large parents run them concurrently
+  run(0);
+  if (settled.load() != 0) {
+    const size_t cells = static_cast<size_t>(parent.sizeX()) *
+                         parent.sizeY() * parent.sizeZ();
+    if (cells >= kParallelCells_) {
+      Parallel::parallelFor(
+          candidates.size() - 1, [&](size_t i) { run(i + 1); });
+    } else {
+      for (size_t i = 1; i < candidates.size(); ++i) run(i);
+    }
   }
 
-  if (scanlineBlocks.size() < minBlocks) {
-    best = std::move(scanlineBlocks);
+  // The settled candidate, or else the one with fewest blocks. Ties go by
+  // the original preference order (Optimal3D, LayeredSlice, MaxRect,
+  // Greedy, Scanline), not by cost.
+  size_t best = settled.load();
+  if (best == kNone) {
+    constexpr std::array<size_t, 5> preference = {2, 3, 4, 0, 1};
+    best = preference[0];
+    for (size_t i : preference) {
+      if (results[i].size() < results[best].size()) best = i;
+    }
   }
 
-  return best;
+  ++labels_;
+  lowerBound_ += bound;
+  blocks_ += results[best].size();
+  if (settled.load() != kNone) ++earlyExits_;
+  for (bool r : ran) skipped_ += r ? 0 : 1;
+  // Hand the winner over; its old buffer is reused by the next label
+  out.swap(results[best]);
 }
 
-std::vector<BlockDesc> SmartMergeStrat::mergeAdjacentBlocks(
-    std::vector<BlockDesc> blocks) {
-  if (blocks.empty()) return blocks;
-
-  // Sort blocks to facilitate merging
-  // Sort by: z, then y, then x (z-major order)
+std::vector<BlockDesc> mergeBlocks(std::vector<BlockDesc> blocks) {
+  // z, y, x order: every block a block can absorb comes after it
   std::sort(blocks.begin(), blocks.end(), [](const BlockDesc& a, const BlockDesc& b) {
     if (a.z != b.z) return a.z < b.z;
     if (a.y != b.y) return a.y < b.y;
-    return a.x < b.x;
+    if (a.x != b.x) return a.x < b.x;
+    return a.labelId < b.labelId;
   });
 
+  thread_local std::array<FaceTable, 3> nearFace;
+  std::vector<uint8_t> consumed;
   std::vector<BlockDesc> merged;
-  merged.reserve(blocks.size());
-
-  size_t i = 0;
-  while (i < blocks.size()) {
-    BlockDesc current = blocks[i];
-    bool didMerge = true;
-
-    // Keep trying to merge until no more merges possible
-    while (didMerge) {
-      didMerge = false;
-
-      // Try to merge with subsequent blocks
-      for (size_t j = i + 1; j < blocks.size(); ++j) {
-        const BlockDesc& candidate = blocks[j];
-
-        // Skip if already merged (dx=0 is our marker for "consumed")
-        if (candidate.dx == 0) continue;
-
-        // Only merge blocks with same label
-        if (candidate.labelId != current.labelId) continue;
-
-        // Try merging in X direction (horizontally adjacent)
-        if (current.y == candidate.y && current.z == candidate.z &&
-            current.dy == candidate.dy && current.dz == candidate.dz &&
-            current.x + current.dx == candidate.x) {
-          // Merge: extend current block in X
-          current.dx += candidate.dx;
-          blocks[j].dx = 0;  // Mark as consumed
-          didMerge = true;
-          continue;
-        }
-
-        // Try merging in Y direction (vertically adjacent)
-        if (current.x == candidate.x && current.z == candidate.z &&
-            current.dx == candidate.dx && current.dz == candidate.dz &&
-            current.y + current.dy == candidate.y) {
-          // Merge: extend current block in Y
-          current.dy += candidate.dy;
-          blocks[j].dy = 0;  // Mark as consumed
-          didMerge = true;
-          continue;
-        }
 
-        // Try merging in Z direction (depth adjacent)
-        if (current.x == candidate.x && current.y == candidate.y &&
-            current.dx == candidate.dx && current.dy == candidate.dy &&
-            current.z + current.dz == candidate.z) {
-          // Merge: extend current block in Z
-          current.dz += candidate.dz;
-          blocks[j].dz = 0;  // Mark as consumed
-          didMerge = true;
-          continue;
+  // A block can grow to match a neighbour that was already visited, so
+  // repeat until a pass merges nothing; the output stays sorted
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (int axis = 0; axis < 3; ++axis) nearFace[axis].build(blocks, axis);
+    consumed.assign(blocks.size(), 0);
+    merged.clear();
+
+    for (uint32_t i = 0; i < blocks.size(); ++i) {
+      if (consumed[i]) continue;
+      consumed[i] = 1;
+      BlockDesc current = blocks[i];
+
+      // Absorb whichever block starts at the far face, until none does
+      bool grew = true;
+      while (grew) {
+        grew = false;
+        for (int axis = 0; axis < 3; ++axis) {
+          const int far = axisStart(current, axis) + axisSize(current, axis);
+          const uint32_t j =
+              nearFace[axis].find(blocks, axis, faceKey(current, axis, far));
+          if (j == FaceTable::kNone || consumed[j]) continue;
+          consumed[j] = 1;
+          axisSize(current, axis) += axisSize(blocks[j], axis);
+          grew = changed = true;
         }
       }
+      merged.push_back(current);
     }
-
-    // Add the merged block
-    merged.push_back(current);
-    ++i;
-
-    // Skip consumed blocks
-    while (i < blocks.size() && blocks[i].dx == 0) {
-      ++i;
-    }
+    blocks.swap(merged);
   }
+  return blocks;
+}
 
-  return merged;
+std::vector<BlockDesc> SmartMergeStrat::mergeAdjacentBlocks(
+    std::vector<BlockDesc> blocks) {
+  return mergeBlocks(std::move(blocks));
 }
 
-std::vector<BlockDesc> MaxCuboidStrat::cover(const ParentBlock& parent, uint32_t labelId) {
+std::vector<BlockDesc> MaxCuboidStrat::coverLabel(const ParentBlock& parent,
+                                                  uint32_t labelId) {
   std::vector<BlockDesc> out;
   const int W = parent.sizeX();
   const int H = parent.sizeY();
@@ -558,151 +932,216 @@ std::vector<BlockDesc> MaxCuboidStrat::cover(const ParentBlock& parent, uint32_t
   const int oz = parent.originZ();
 
   if (W <= 0 || H <= 0 || D <= 0) return out;
-  const auto& grid = parent.grid();
-
-  auto id3 = [W, H](int x, int y, int z) -> size_t {
-    return static_cast<size_t>(x) + static_cast<size_t>(y) * W +
-           static_cast<size_t>(z) * W * H;
-  };
 
-  // Build mask for the label
-  std::vector<uint8_t> mask(static_cast<size_t>(W) * H * D, 0);
+  // Bit-packed mask of the label: words per row, H rows per slice
+  const auto& planes = parent.planes();
+  const size_t words = planes.wordsPerRow();
+  const size_t sliceWords = words * H;
+  std::vector<uint64_t> mask(sliceWords * D);
+  size_t remaining = 0;
   for (int z = 0; z < D; ++z)
-    for (int y = 0; y < H; ++y)
-      for (int x = 0; x < W; ++x)
-        if (grid.at(x, y, z) == labelId) mask[id3(x, y, z)] = 1;
-
-  // Helper: check if any 1 remains
-  auto any_one = [&]() -> bool {
-    for (auto v : mask) if (v) return true;
-    return false;
-  };
-
-  // Compute largest rectangle in a binary matrix B (H x W), return area and rectangle coords (x0,y0,dx,dy)
-  auto maxRectBinary = [&](const std::vector<uint8_t>& B,
-                           int& rx0, int& ry0, int& rdx, int& rdy) -> int64_t {
-    std::vector<int> heights(W, 0);
-    int64_t bestArea = 0;
-    int best_x0 = 0, best_y0 = 0, best_dx = 0, best_dy = 0;
-
     for (int y = 0; y < H; ++y) {
-      // update heights
-      for (int x = 0; x < W; ++x) {
-        heights[x] = (B[y * W + x] ? heights[x] + 1 : 0);
-      }
-      // largest rectangle in histogram for this row
-      std::vector<int> st;
-      std::vector<int> left(W), right(W);
-      for (int x = 0; x < W; ++x) {
-        while (!st.empty() && heights[st.back()] >= heights[x]) st.pop_back();
-        left[x] = st.empty() ? 0 : st.back() + 1;
-        st.push_back(x);
-      }
-      st.clear();
-      for (int x = W - 1; x >= 0; --x) {
-        while (!st.empty() && heights[st.back()] >= heights[x]) st.pop_back();
-        right[x] = st.empty() ? W - 1 : st.back() - 1;
-        st.push_back(x);
-      }
-      for (int x = 0; x < W; ++x) {
-        if (heights[x] == 0) continue;
-        int width = right[x] - left[x] + 1;
-        int64_t area = static_cast<int64_t>(width) * heights[x];
-        if (area > bestArea) {
-          bestArea = area;
-          best_dx = width;
-          best_dy = heights[x];
-          // heights[x] extends up to current row y, so y0 = y - dy + 1
-          best_y0 = y - best_dy + 1;
-          // we need x0; left[x] is left boundary
-          best_x0 = left[x];
-        }
-      }
+      const uint64_t* src = planes.row(labelId, y, z);
+      std::copy(src, src + words, &mask[z * sliceWords + y * words]);
+      for (size_t w = 0; w < words; ++w) remaining += popcount64(src[w]);
     }
-    rx0 = best_x0; ry0 = best_y0; rdx = best_dx; rdy = best_dy;
-    return bestArea;
-  };
 
-  // Main loop: repeatedly find the maximum-volume cuboid and remove it
-  while (any_one()) {
-    int bestX = 0, bestY = 0, bestZ = 0, bestDX = 0, bestDY = 0, bestDZ = 0;
-    int64_t bestVol = 0;
-
-    // For each starting slice z0, grow depth h and AND slices into B
-    std::vector<uint8_t> B(static_cast<size_t>(W) * H, 0);
-    for (int z0 = 0; z0 < D; ++z0) {
-      // initialize B with slice z0
-      bool any = false;
+  // Best cuboid starting at slice z0: the first (h, rectangle) of maximum
+  // volume, exactly as an exhaustive scan over h would pick it. 'reach' is
+  // how many slices from z0 the search read; the result stays valid until a
+  // removal touches one of them. Removals only shrink volumes, so a dirty
+  // entry's 'vol' is still an upper bound.
+  struct Z0Best {
+    int64_t vol{std::numeric_limits<int64_t>::max()};
+    int x{0}, y{0}, dx{0}, dy{0}, h{0};
+    int reach{0};
+    bool dirty{true};
+  };
+  std::vector<Z0Best> best(static_cast<size_t>(D));
+  // Largest rectangle last found for each (z0, h); removals only shrink
+  // it, so it bounds the next search of that pair
+  std::vector<int64_t> areaBound(static_cast<size_t>(D) * D,
+                                 std::numeric_limits<int64_t>::max());
+
+  auto search = [&](int z0) {
+    // Per-thread scratch, reused across calls
+    thread_local std::vector<uint64_t> B, colOr;
+    thread_local std::vector<int> heights, left, right, st;
+    B.assign(mask.begin() + z0 * sliceWords,
+             mask.begin() + (z0 + 1) * sliceWords);
+    heights.resize(W);
+    left.resize(W);
+    right.resize(W);
+    st.resize(W);
+    colOr.resize(words);
+
+    // Largest rectangle of B (histogram per row, first maximum). Rows and
+    // columns outside B's bounding box hold only zero heights, which bound
+    // every rectangle anyway, so the scan is limited to the box.
+    auto maxRectBinary = [&](int& rx0, int& ry0, int& rdx, int& rdy) {
+      int yBegin = H, yEnd = 0;
+      std::fill(colOr.begin(), colOr.end(), 0);
       for (int y = 0; y < H; ++y) {
-        for (int x = 0; x < W; ++x) {
-          uint8_t v = mask[id3(x, y, z0)];
-          B[y * W + x] = v;
-          any |= (v != 0);
+        uint64_t any = 0;
+        for (size_t w = 0; w < words; ++w) {
+          colOr[w] |= B[y * words + w];
+          any |= B[y * words + w];
+        }
+        if (any) {
+          yBegin = std::min(yBegin, y);
+          yEnd = y + 1;
         }
       }
-      if (!any) continue;
-
-      for (int h = 1; z0 + h - 1 < D; ++h) {
-        if (h > 1) {
-          int z = z0 + h - 1;
-          // AND next slice into B
-          bool any2 = false;
-          for (int y = 0; y < H; ++y) {
-            for (int x = 0; x < W; ++x) {
-              uint8_t nv = (B[y * W + x] & mask[id3(x, y, z)]);
-              B[y * W + x] = nv;
-              any2 |= (nv != 0);
-            }
+      int xBegin = W, xEnd = 0;
+      for (size_t w = 0; w < words; ++w) {
+        if (!colOr[w]) continue;
+        xBegin = std::min(xBegin, static_cast<int>(w * 64) + __builtin_ctzll(colOr[w]));
+        xEnd = static_cast<int>(w * 64) + 64 - __builtin_clzll(colOr[w]);
+      }
+
+      std::fill(heights.begin(), heights.end(), 0);
+      int64_t bestArea = 0;
+      for (int y = yBegin; y < yEnd; ++y) {
+        const uint64_t* row = &B[y * words];
+        for (int x = xBegin; x < xEnd; ++x)
+          heights[x] = ((row[x >> 6] >> (x & 63)) & 1u) ? heights[x] + 1 : 0;
+        int top = 0;
+        for (int x = xBegin; x < xEnd; ++x) {
+          while (top > 0 && heights[st[top - 1]] >= heights[x]) --top;
+          left[x] = top == 0 ? xBegin : st[top - 1] + 1;
+          st[top++] = x;
+        }
+        top = 0;
+        for (int x = xEnd - 1; x >= xBegin; --x) {
+          while (top > 0 && heights[st[top - 1]] >= heights[x]) --top;
+          right[x] = top == 0 ? xEnd - 1 : st[top - 1] - 1;
+          st[top++] = x;
+        }
+        for (int x = xBegin; x < xEnd; ++x) {
+          if (heights[x] == 0) continue;
+          const int width = right[x] - left[x] + 1;
+          const int64_t area = static_cast<int64_t>(width) * heights[x];
+          if (area > bestArea) {
+            bestArea = area;
+            rdx = width;
+            rdy = heights[x];
+            ry0 = y - rdy + 1;
+            rx0 = left[x];
           }
-          if (!any2) break;
         }
+      }
+      return bestArea;
+    };
 
-        int rx0 = 0, ry0 = 0, rdx = 0, rdy = 0;
-        int64_t area = maxRectBinary(B, rx0, ry0, rdx, rdy);
-        if (area <= 0) continue;
-        int64_t vol = area * h;
-        if (vol > bestVol) {
-          bestVol = vol;
-          bestX = rx0;
-          bestY = ry0;
-          bestDX = rdx;
-          bestDY = rdy;
-          bestZ = z0;
-          bestDZ = h;
+    Z0Best r;
+    r.vol = 0;
+    r.dirty = false;
+    for (int h = 1; z0 + h - 1 < D; ++h) {
+      r.reach = h;
+      int64_t ones = 0;
+      if (h > 1) {
+        // AND next slice into B
+        const uint64_t* next = &mask[(z0 + h - 1) * sliceWords];
+        for (size_t i = 0; i < sliceWords; ++i) {
+          B[i] &= next[i];
+          ones += popcount64(B[i]);
         }
+      } else {
+        for (size_t i = 0; i < sliceWords; ++i) ones += popcount64(B[i]);
       }
+      if (ones == 0) break;
+      // Depth only removes cells, so 'ones' bounds every later area too
+      if (ones * (D - z0) <= r.vol) break;
+      int64_t& bound = areaBound[static_cast<size_t>(z0) * D + (h - 1)];
+      if (std::min(ones, bound) * h <= r.vol) continue;
+
+      int rx0 = 0, ry0 = 0, rdx = 0, rdy = 0;
+      const int64_t area = maxRectBinary(rx0, ry0, rdx, rdy);
+      bound = area;
+      const int64_t vol = area * h;
+      if (vol > r.vol) {
+        r.vol = vol;
+        r.x = rx0;
+        r.y = ry0;
+        r.dx = rdx;
+        r.dy = rdy;
+        r.h = h;
+      }
+    }
+    best[static_cast<size_t>(z0)] = r;
+  };
+
+  std::vector<size_t> dirty;
+  const bool parallel = static_cast<size_t>(W) * H * D >= kParallelCells_;
+
+  // Main loop: repeatedly take the maximum-volume cuboid and remove it
+  while (remaining > 0) {
+    // Redo only dirty searches whose bound can still reach the best clean
+    // volume; the others cannot win (a tie would need an equal volume)
+    int64_t cleanBest = 0;
+    for (const Z0Best& e : best)
+      if (!e.dirty) cleanBest = std::max(cleanBest, e.vol);
+    dirty.clear();
+    for (int z0 = 0; z0 < D; ++z0) {
+      const Z0Best& e = best[static_cast<size_t>(z0)];
+      if (e.dirty && e.vol >= cleanBest) dirty.push_back(static_cast<size_t>(z0));
+    }
+    if (parallel && dirty.size() > 1) {
+      Parallel::parallelFor(
+          dirty.size(), [&](size_t i) { search(static_cast<int>(dirty[i])); });
+    } else {
+      for (size_t z0 : dirty) search(static_cast<int>(z0));
     }
 
-    if (bestVol == 0) break; // nothing left
+    int bestZ = -1;
+    for (int z0 = 0; z0 < D; ++z0) {
+      const Z0Best& e = best[static_cast<size_t>(z0)];
+      if (!e.dirty && e.vol > (bestZ < 0 ? 0 : best[static_cast<size_t>(bestZ)].vol))
+        bestZ = z0;
+    }
+    if (bestZ < 0) break;  // nothing left
+    const Z0Best b = best[static_cast<size_t>(bestZ)];
 
     // Emit block in global coordinates
-    out.push_back(BlockDesc{ox + bestX, oy + bestY, oz + bestZ,
-                            bestDX, bestDY, bestDZ, labelId});
+    out.push_back(BlockDesc{ox + b.x, oy + b.y, oz + bestZ, b.dx, b.dy, b.h,
+                            labelId});
 
     // Clear mask region
-    for (int z = bestZ; z < bestZ + bestDZ; ++z)
-      for (int y = bestY; y < bestY + bestDY; ++y)
-        for (int x = bestX; x < bestX + bestDX; ++x)
-          mask[id3(x, y, z)] = 0;
+    for (int z = bestZ; z < bestZ + b.h; ++z)
+      for (int y = b.y; y < b.y + b.dy; ++y) {
+        uint64_t* row = &mask[z * sliceWords + y * words];
+        for (int x = b.x; x < b.x + b.dx; ++x) row[x >> 6] &= ~(1ull << (x & 63));
+      }
+    remaining -= static_cast<size_t>(b.dx) * b.dy * b.h;
+
+    // Only searches that read a changed slice need redoing
+    for (int z0 = 0; z0 < D; ++z0) {
+      Z0Best& e = best[static_cast<size_t>(z0)];
+      if (z0 < bestZ + b.h && z0 + e.reach > bestZ) e.dirty = true;
+    }
   }
 
   return out;
 }
 
-std::vector<BlockDesc> LayeredSliceStrat::cover(const ParentBlock& parent, uint32_t labelId) {
-  std::vector<BlockDesc> out;
+void LayeredSliceStrat::coverLabel(const ParentBlock& parent, uint32_t labelId,
+                                   std::vector<BlockDesc>& out) {
+  out.clear();
   const int W = parent.sizeX(), H = parent.sizeY(), D = parent.sizeZ();
   const int ox = parent.originX(), oy = parent.originY(), oz = parent.originZ();
 
-  if (W <= 0 || H <= 0 || D <= 0) return out;
+  if (W <= 0 || H <= 0 || D <= 0) return;
 
   // Build hash for each Z-slice
+  const auto& planes = parent.planes();
   std::vector<size_t> sliceHashes(D);
   auto buildSliceHash = [&](int z) -> size_t {
     size_t hash = 0;
     for (int y = 0; y < H; ++y) {
-      for (int x = 0; x < W; ++x) {
-        if (parent.grid().at(x, y, z) == labelId) {
+      const uint64_t* bits = planes.row(labelId, y, z);
+      for (size_t w = 0; w < planes.wordsPerRow(); ++w) {
+        for (uint64_t word = bits[w]; word; word &= word - 1) {
+          const int x = static_cast<int>(w * 64) + __builtin_ctzll(word);
           hash ^= std::hash<int>{}(x + y * W + z * W * H) + 0x9e3779b9 + (hash << 6) + (hash >> 2);
         }
       }
@@ -715,6 +1154,7 @@ std::vector<BlockDesc> LayeredSliceStrat::cover(const ParentBlock& parent, uint3
   }
 
   // Group consecutive slices with same hash (likely identical)
+  std::vector<Rect2D> rects;
   int z = 0;
   while (z < D) {
     int startZ = z;
@@ -727,34 +1167,25 @@ std::vector<BlockDesc> LayeredSliceStrat::cover(const ParentBlock& parent, uint3
     int depth = z - startZ;
 
     // For this slice pattern, decompose using MaxRect once
-    std::vector<uint8_t> mask(W * H, 0);
-    for (int y = 0; y < H; ++y) {
-      for (int x = 0; x < W; ++x) {
-        if (parent.grid().at(x, y, startZ) == labelId) {
-          mask[y * W + x] = 1;
-        }
-      }
-    }
-
-    // Get 2D rectangles for this slice
-    std::vector<Rect2D> rects = coverSliceWithMaxRects(std::move(mask), W, H);
+    coverSliceWithMaxRects(parent, labelId, startZ, rects);
 
     // Emit each rectangle with the appropriate Z-depth
     for (const auto& r : rects) {
       out.push_back(BlockDesc{ox + r.x, oy + r.y, oz + startZ, r.w, r.h, depth, labelId});
     }
   }
-
-  return out;
 }
 
-std::vector<BlockDesc> QuadTreeStrat::cover(const ParentBlock& parent, uint32_t labelId) {
+std::vector<BlockDesc> QuadTreeStrat::coverLabel(const ParentBlock& parent,
+                                                 uint32_t labelId) {
   std::vector<BlockDesc> out;
   const int W = parent.sizeX(), H = parent.sizeY(), D = parent.sizeZ();
   const int ox = parent.originX(), oy = parent.originY(), oz = parent.originZ();
 
   if (W <= 0 || H <= 0 || D <= 0) return out;
 
+  const auto& planes = parent.planes();
+
   // Process each Z-slice with quadtree decomposition
   for (int z = 0; z < D; ++z) {
     std::function<void(int, int, int, int)> quadtreeDecompose;
@@ -766,12 +1197,12 @@ std::vector<BlockDesc> QuadTreeStrat::cover(const ParentBlock& parent, uint32_t
       bool anyMatch = false;
       for (int y = y0; y < y0 + h && allMatch; ++y) {
         for (int x = x0; x < x0 + w && allMatch; ++x) {
-          bool matches = (parent.grid().at(x, y, z) == labelId);
+          bool matches = planes.test(labelId, x, y, z);
           if (matches) anyMatch = true;
           if (y == y0 && x == x0) {
             // First cell sets the expectation
           } else {
-            if (matches != (parent.grid().at(x0, y0, z) == labelId)) {
+            if (matches != planes.test(labelId, x0, y0, z)) {
               allMatch = false;
             }
           }
@@ -796,9 +1227,9 @@ std::vector<BlockDesc> QuadTreeStrat::cover(const ParentBlock& parent, uint32_t
           for (int y = y0; y < y0 + h; ++y) {
             int x = x0;
             while (x < x0 + w) {
-              if (parent.grid().at(x, y, z) == labelId) {
+              if (planes.test(labelId, x, y, z)) {
                 int runStart = x;
-                while (x < x0 + w && parent.grid().at(x, y, z) == labelId) ++x;
+                while (x < x0 + w && planes.test(labelId, x, y, z)) ++x;
                 out.push_back(BlockDesc{ox + runStart, oy + y, oz + z, x - runStart, 1, 1, labelId});
               } else {
                 ++x;
@@ -818,95 +1249,85 @@ std::vector<BlockDesc> QuadTreeStrat::cover(const ParentBlock& parent, uint32_t
   return out;
 }
 
-std::vector<BlockDesc> ScanlineStrat::cover(const ParentBlock& parent, uint32_t labelId) {
-  std::vector<BlockDesc> out;
+void ScanlineStrat::coverLabel(const ParentBlock& parent, uint32_t labelId,
+                               std::vector<BlockDesc>& out) {
+  out.clear();
   const int W = parent.sizeX(), H = parent.sizeY(), D = parent.sizeZ();
   const int ox = parent.originX(), oy = parent.originY(), oz = parent.originZ();
 
-  if (W <= 0 || H <= 0 || D <= 0) return out;
+  if (W <= 0 || H <= 0 || D <= 0) return;
+
+  const auto& planes = parent.planes();
+  const size_t rowWords = planes.wordsPerRow();
+  const size_t colWords = (static_cast<size_t>(H) + 63) / 64;
+
+  // Slice transposed into one bit column per x, so vertical runs come
+  // from the same word scan as horizontal ones
+  std::vector<uint64_t> columns(static_cast<size_t>(W) * colWords);
+  std::vector<std::pair<int, int>> runs;
+  // Rectangles ending at the current column, sorted by y0
+  std::vector<Rect2D> active, next;
+
+  auto emit = [&](const Rect2D& r, int z) {
+    out.push_back(BlockDesc{ox + r.x, oy + r.y, oz + z, r.w, r.h, 1, labelId});
+  };
 
   // Process each Z-slice with scanline
   for (int z = 0; z < D; ++z) {
-    // Build vertical runs for each column
-    std::vector<std::vector<std::pair<int, int>>> columnRuns(W);
-
-    for (int x = 0; x < W; ++x) {
-      int y = 0;
-      while (y < H) {
-        while (y < H && parent.grid().at(x, y, z) != labelId) ++y;
-        if (y >= H) break;
-        int startY = y;
-        while (y < H && parent.grid().at(x, y, z) == labelId) ++y;
-        columnRuns[x].push_back({startY, y - startY});
+    std::fill(columns.begin(), columns.end(), 0);
+    for (int y = 0; y < H; ++y) {
+      const uint64_t* row = planes.row(labelId, y, z);
+      const uint64_t bit = 1ull << (y & 63);
+      const size_t yw = static_cast<size_t>(y) >> 6;
+      for (size_t w = 0; w < rowWords; ++w) {
+        for (uint64_t word = row[w]; word; word &= word - 1) {
+          const size_t x = w * 64 + __builtin_ctzll(word);
+          columns[x * colWords + yw] |= bit;
+        }
       }
     }
 
-    // Sweep left to right, merging compatible vertical segments
-    std::vector<std::tuple<int, int, int, int>> activeRects; // {x0, y0, width, height}
-
+    // Sweep left to right: a vertical run extends the active rectangle
+    // with the same y0 and height, everything else is emitted or started
+    active.clear();
     for (int x = 0; x < W; ++x) {
-      std::vector<std::tuple<int, int, int, int>> nextRects;
-
-      for (const auto& run : columnRuns[x]) {
-        int y0 = run.first;
-        int height = run.second;
-
-        // Try to extend existing rectangle
-        bool extended = false;
-        for (auto& rect : activeRects) {
-          int rx0 = std::get<0>(rect);
-          int ry0 = std::get<1>(rect);
-          int rw = std::get<2>(rect);
-          int rh = std::get<3>(rect);
-
-          if (ry0 == y0 && rh == height && rx0 + rw == x) {
-            // Can extend this rectangle
-            std::get<2>(rect) = rw + 1;
-            nextRects.push_back(rect);
-            extended = true;
-            break;
-          }
-        }
-
-        if (!extended) {
-          // Start new rectangle
-          nextRects.push_back({x, y0, 1, height});
+      findRowRuns(&columns[static_cast<size_t>(x) * colWords], H, runs);
+      next.clear();
+      size_t a = 0, r = 0;
+      while (a < active.size() || r < runs.size()) {
+        const int runY = r < runs.size() ? runs[r].first : H;
+        if (a < active.size() && active[a].y < runY) {
+          emit(active[a++], z);
+          continue;
         }
-      }
-
-      // Emit rectangles that weren't extended
-      for (const auto& rect : activeRects) {
-        bool found = false;
-        for (const auto& next : nextRects) {
-          if (std::get<0>(rect) == std::get<0>(next) &&
-              std::get<1>(rect) == std::get<1>(next)) {
-            found = true;
-            break;
+        const int runH = runs[r].second - runY;
+        if (a < active.size() && active[a].y == runY) {
+          if (active[a].h == runH) {
+            ++active[a].w;
+            next.push_back(active[a]);
+          } else {
+            emit(active[a], z);
+            next.push_back(Rect2D{x, runY, 1, runH});
           }
+          ++a;
+        } else {
+          next.push_back(Rect2D{x, runY, 1, runH});
         }
-        if (!found) {
-          out.push_back(BlockDesc{ox + std::get<0>(rect), oy + std::get<1>(rect), oz + z,
-                                 std::get<2>(rect), std::get<3>(rect), 1, labelId});
-        }
+        ++r;
       }
-
-      activeRects = std::move(nextRects);
+      active.swap(next);
     }
 
     // Emit remaining active rectangles
-    for (const auto& rect : activeRects) {
-      out.push_back(BlockDesc{ox + std::get<0>(rect), oy + std::get<1>(rect), oz + z,
-                             std::get<2>(rect), std::get<3>(rect), 1, labelId});
-    }
+    for (const auto& rect : active) emit(rect, z);
   }
 
   // Stack in Z
   out = SmartMergeStrat::mergeAdjacentBlocks(std::move(out));
-
-  return out;
 }
 
-std::vector<BlockDesc> AdaptiveStrat::cover(const ParentBlock& parent, uint32_t labelId) {
+std::vector<BlockDesc> AdaptiveStrat::coverLabel(const ParentBlock& parent,
+                                                 uint32_t labelId) {
   const int W = parent.sizeX(), H = parent.sizeY(), D = parent.sizeZ();
 
   if (W <= 0 || H <= 0 || D <= 0) {
@@ -914,22 +1335,20 @@ std::vector<BlockDesc> AdaptiveStrat::cover(const ParentBlock& parent, uint32_t
   }
 
   // Analyze data characteristics
-  int totalCells = 0;
+  const int totalCells = W * H * D;
   int labelCells = 0;
   double zCorrelation = 0.0;
 
+  const auto& planes = parent.planes();
+  const size_t words = planes.wordsPerRow();
   for (int z = 0; z < D; ++z) {
     for (int y = 0; y < H; ++y) {
-      for (int x = 0; x < W; ++x) {
-        ++totalCells;
-        if (parent.grid().at(x, y, z) == labelId) {
-          ++labelCells;
-
-          // Check Z-correlation (similarity to next slice)
-          if (z < D - 1 && parent.grid().at(x, y, z + 1) == labelId) {
-            zCorrelation += 1.0;
-          }
-        }
+      const uint64_t* bits = planes.row(labelId, y, z);
+      // Z-correlation: cells that also carry the label in the next slice
+      const uint64_t* above = z < D - 1 ? planes.row(labelId, y, z + 1) : nullptr;
+      for (size_t w = 0; w < words; ++w) {
+        labelCells += popcount64(bits[w]);
+        if (above) zCorrelation += popcount64(bits[w] & above[w]);
       }
     }
   }
@@ -971,12 +1390,26 @@ StreamRLEXY::StreamRLEXY(int X, int Y, int Z, int PX, int PY,
   active_.resize(static_cast<size_t>(numNx_));
   nextActive_.resize(static_cast<size_t>(numNx_));
   currRuns_.resize(static_cast<size_t>(numNx_));
+  rowStarts_.resize((static_cast<size_t>(numNx_) * PX_ + 63) / 64);
 }
 
-void StreamRLEXY::onRow(int z, int y, const std::string& row,
+void StreamRLEXY::onRow(int z, int y, std::string_view row,
                         std::vector<Model::BlockDesc>& out) {
+  // Translate and validate the whole row once
+  const size_t n = static_cast<size_t>(numNx_) * PX_;
+  rowIds_.resize(n);
+  const size_t bad = labels_.translate(row.data(), n, rowIds_.data());
+  if (bad != n) {
+    throw std::runtime_error(std::string("Unknown tag: '") + row[bad] +
+                             "' at column " + std::to_string(bad));
+  }
+  onRowIds(z, y, rowIds_.data(), out);
+}
+
+void StreamRLEXY::onRowIds(int z, int y, const uint8_t* ids,
+                           std::vector<Model::BlockDesc>& out) {
   // Build horizontal runs for this row
-  buildRunsForRow(row);
+  buildRunsForRow(ids);
 
   // Check if we're at a PY stripe boundary
   const int localY = y % PY_;
@@ -1001,13 +1434,70 @@ void StreamRLEXY::onSliceEnd(int z, std::vector<Model::BlockDesc>& out) {
   for (auto& tile : active_) {
     tile.clear();
   }
+
+  if (PZ_ == 0) return;
+  if ((z + 1) % PZ_ == 0) {
+    // Parent-Z boundary: nothing stacks across it
+    onStreamEnd(out);
+    return;
+  }
+  // Blocks that did not recur in this slice are complete
+  for (auto it = stacked_.begin(); it != stacked_.end();) {
+    if (it->second.z + it->second.dz <= z) {
+      flushed_.push_back(it->second);
+      it = stacked_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+  drainFlushed(out);
 }
 
-void StreamRLEXY::buildRunsForRow(const std::string& row) {
-  // Clear previous runs
-  for (auto& runs : currRuns_) {
-    runs.clear();
+void StreamRLEXY::onStreamEnd(std::vector<Model::BlockDesc>& out) {
+  for (const auto& kv : stacked_) flushed_.push_back(kv.second);
+  stacked_.clear();
+  drainFlushed(out);
+}
+
+void StreamRLEXY::drainFlushed(std::vector<Model::BlockDesc>& out) {
+  // stacked_ iterates in hash order; sort so output depends only on input
+  std::sort(flushed_.begin(), flushed_.end(),
+            [](const Model::BlockDesc& a, const Model::BlockDesc& b) {
+              return std::tie(a.y, a.x, a.z, a.dy, a.dx, a.labelId) <
+                     std::tie(b.y, b.x, b.z, b.dy, b.dx, b.labelId);
+            });
+  out.insert(out.end(), flushed_.begin(), flushed_.end());
+  flushed_.clear();
+}
+
+void StreamRLEXY::setStackZ(int PZ) { PZ_ = std::max(0, PZ); }
+
+size_t StreamRLEXY::StackKeyHash::operator()(const StackKey& k) const {
+  uint64_t h = k.labelId;
+  for (int f : {k.x0, k.x1, k.startY, k.height})
+    h = (h ^ static_cast<uint32_t>(f)) * 0x9E3779B97F4A7C15ull;
+  return static_cast<size_t>(h ^ (h >> 32));
+}
+
+void StreamRLEXY::emit(int z, const Group& g,
+                       std::vector<Model::BlockDesc>& out) {
+  if (PZ_ == 0) {
+    out.push_back(toBlock(z, g));
+    return;
+  }
+  const StackKey key{g.x0, g.x1, g.startY, g.height, g.labelId};
+  auto it = stacked_.find(key);
+  if (it == stacked_.end()) {
+    stacked_.emplace(key, toBlock(z, g));
+  } else {
+    // Present in the previous slice (older entries are evicted)
+    ++it->second.dz;
   }
+}
+
+void StreamRLEXY::buildRunsForRow(const uint8_t* ids) {
+  // Mark label changes for the whole row at once
+  Model::runStarts(ids, static_cast<size_t>(numNx_) * PX_, rowStarts_.data());
 
   // Build runs for each tile
   for (int nx = 0; nx < numNx_; ++nx) {
@@ -1015,27 +1505,23 @@ void StreamRLEXY::buildRunsForRow(const std::string& row) {
     const int tileEndX = tileStartX + PX_;
 
     auto& runs = currRuns_[static_cast<size_t>(nx)];
+    runs.clear();
 
-    // RLE within this tile
+    // A run always starts at the tile edge, then at each marked change
     int x = tileStartX;
     while (x < tileEndX) {
-      const char tag = row[static_cast<size_t>(x)];
-      const uint32_t labelId = labels_.getId(tag);
-      const int runStart = x;
-
-      // Extend run while same label
-      while (x < tileEndX && row[static_cast<size_t>(x)] == tag) {
-        ++x;
-      }
-
-      // Store run
-      runs.push_back(Run{runStart, x, labelId});
+      const int next = nextBit(rowStarts_.data(), x + 1, tileEndX, true);
+      runs.push_back(Run{x, next, ids[x]});
+      x = next;
     }
   }
 }
 
 void StreamRLEXY::mergeRow(int z, int y, std::vector<Model::BlockDesc>& out) {
-  // Process each tile independently
+  // Process each tile independently. Runs tile the row and active groups
+  // all end on the previous row, both sorted by x0, so one merge pass
+  // pairs them up; an active group is continued only by the run that
+  // starts where it does with the same extent and label.
   for (int nx = 0; nx < numNx_; ++nx) {
     auto& active = active_[static_cast<size_t>(nx)];
     auto& nextActive = nextActive_[static_cast<size_t>(nx)];
@@ -1043,44 +1529,29 @@ void StreamRLEXY::mergeRow(int z, int y, std::vector<Model::BlockDesc>& out) {
 
     nextActive.clear();
 
-    // Try to extend existing groups with current runs
+    size_t a = 0;
     for (const auto& run : runs) {
-      bool merged = false;
-
-      // Check if this run can extend an active group
-      for (auto& group : active) {
-        if (group.labelId == run.labelId &&
-            group.x0 == run.x0 &&
-            group.x1 == run.x1 &&
-            group.startY + group.height == y) {
+      // Groups left of this run were not continued: they end here
+      while (a < active.size() && active[a].x0 < run.x0) {
+        emit(z, active[a++], out);
+      }
+
+      if (a < active.size() && active[a].x0 == run.x0) {
+        Group& group = active[a++];
+        if (group.x1 == run.x1 && group.labelId == run.labelId) {
           // Extend the group vertically
           ++group.height;
           nextActive.push_back(group);
-          merged = true;
-          break;
+          continue;
         }
+        emit(z, group, out);
       }
 
-      if (!merged) {
-        // Start new group from this run
-        // (Old groups will be emitted later when we check what wasn't continued)
-        nextActive.push_back(Group{run.x0, run.x1, y, 1, run.labelId});
-      }
+      // Start new group from this run
+      nextActive.push_back(Group{run.x0, run.x1, y, 1, run.labelId});
     }
-
-    // Emit groups that weren't in nextActive (ended)
-    for (const auto& group : active) {
-      bool found = false;
-      for (const auto& next : nextActive) {
-        if (next.x0 == group.x0 && next.x1 == group.x1 &&
-            next.startY == group.startY && next.labelId == group.labelId) {
-          found = true;
-          break;
-        }
-      }
-      if (!found) {
-        out.push_back(toBlock(z, group));
-      }
+    while (a < active.size()) {
+      emit(z, active[a++], out);
     }
 
     // Swap active and nextActive
@@ -1092,7 +1563,7 @@ void StreamRLEXY::flushStripeEnd(int z, std::vector<Model::BlockDesc>& out) {
   // Emit all remaining active groups
   for (const auto& tile : active_) {
     for (const auto& group : tile) {
-      out.push_back(toBlock(z, group));
+      emit(z, group, out);
     }
   }
 }
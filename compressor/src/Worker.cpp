@@ -1,11 +1,40 @@
 #include "../include/Worker.hpp"
 
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <mutex>
+#include <thread>
 #include <utility>
 
+#include "../include/IO.hpp"
+
 using Model::BlockDesc;
 using Model::ParentBlock;
 
 namespace Worker {
+void WorkerBackend::coverAll(const ParentBlock& parent,
+                             std::vector<BlockDesc>& out) {
+  // The census answers presence without building the bit planes
+  const Model::Census& census = parent.census();
+  for (uint32_t labelId = 0; labelId < census.labelCount(); ++labelId) {
+    if (!census.contains(labelId)) continue;
+    std::vector<BlockDesc> blocks = process(parent, labelId);
+    out.insert(out.end(), blocks.begin(), blocks.end());
+  }
+}
+
+void WorkerBackend::compress(IO::Endpoint& ep) {
+  std::vector<BlockDesc> blocks;
+  while (ep.hasNextParent()) {
+    const ParentBlock parent = ep.nextParent();
+    blocks.clear();
+    coverAll(parent, blocks);
+    ep.write(blocks);
+  }
+}
+
 // DirectWorker implementation
 
 DirectWorker::DirectWorker(std::unique_ptr<Strategy::GroupingStrategy> strat)
@@ -17,16 +46,273 @@ std::vector<BlockDesc> DirectWorker::process(const ParentBlock& parent,
                    : std::vector<BlockDesc>{};
 }
 
+void DirectWorker::coverAll(const ParentBlock& parent,
+                            std::vector<BlockDesc>& out) {
+  if (strategy_) strategy_->coverAll(parent, out);
+}
+
 ThreadWorker::ThreadWorker(std::unique_ptr<Strategy::GroupingStrategy> strat,
                            std::size_t poolSize)
-    : strategy_(std::move(strat)), poolSize_(poolSize) {}
+    : strategy_(std::move(strat)), poolSize_(poolSize), pool_(poolSize) {}
 
 std::vector<BlockDesc> ThreadWorker::process(const ParentBlock& parent,
                                              uint32_t labelId) {
-  // Prototype: no thread pool yet
-
   return strategy_ ? strategy_->cover(parent, labelId)
                    : std::vector<BlockDesc>{};
 }
 
-};  // namespace Worker
\ No newline at end of file
+void ThreadWorker::coverAll(const ParentBlock& parent,
+                            std::vector<BlockDesc>& out) {
+  if (!strategy_) return;
+  if (strategy_->singlePass()) {
+    strategy_->coverAll(parent, out);
+    return;
+  }
+
+  // One stealable task per present label, stitched back in label order
+  const Model::Census& census = parent.census();
+  std::vector<uint32_t> present;
+  for (uint32_t labelId = 0; labelId < census.labelCount(); ++labelId)
+    if (census.contains(labelId)) present.push_back(labelId);
+  std::vector<std::vector<BlockDesc>> perLabel(present.size());
+  pool_.parallelFor(present.size(), [&](std::size_t i) {
+    perLabel[i] = strategy_->cover(parent, present[i]);
+  });
+  for (const auto& blocks : perLabel)
+    out.insert(out.end(), blocks.begin(), blocks.end());
+}
+
+void ThreadWorker::compress(IO::Endpoint& ep) {
+  if (!strategy_ || pool_.size() == 0) {
+    WorkerBackend::compress(ep);
+    return;
+  }
+
+  // One slot per parent in flight; parent i lives in slot i % slots.size().
+  // Each (parent, label) is its own task with its own output buffer, so a
+  // costly parent is spread over every thread that runs dry.
+  struct Slot {
+    Model::Grid grid;
+    Model::Census census;
+    std::unique_ptr<ParentBlock> parent;
+    std::vector<std::vector<BlockDesc>> perLabel;
+    std::vector<BlockDesc> blocks;
+    std::exception_ptr error;
+    std::size_t remaining{0};
+
+    explicit Slot(Model::Grid g) : grid(std::move(g)) {}
+  };
+  std::vector<std::unique_ptr<Slot>> slots;
+  for (std::size_t i = 0; i < 2 * pool_.size(); ++i)
+    slots.push_back(std::make_unique<Slot>(ep.newParentGrid()));
+
+  std::mutex mtx;
+  std::condition_variable cv;
+  auto wait = [&](Slot& slot) {
+    std::unique_lock<std::mutex> lock(mtx);
+    cv.wait(lock, [&] { return slot.remaining == 0; });
+  };
+
+  std::size_t next = 0;  // parents read
+  std::size_t head = 0;  // parents written
+  auto commit = [&]() {
+    Slot& slot = *slots[head % slots.size()];
+    wait(slot);
+    if (slot.error) std::rethrow_exception(slot.error);
+    slot.blocks.clear();
+    for (const auto& blocks : slot.perLabel)
+      slot.blocks.insert(slot.blocks.end(), blocks.begin(), blocks.end());
+    ep.write(slot.blocks);
+    ++head;
+  };
+
+  try {
+    while (ep.hasNextParent()) {
+      if (next - head == slots.size()) commit();  // frees this parent's slot
+      Slot* slot = slots[next % slots.size()].get();
+      slot->parent =
+          std::make_unique<ParentBlock>(ep.nextParent(slot->grid, slot->census));
+      slot->error = nullptr;
+      // Single-pass strategies cover the whole parent in one task (its
+      // blocks go to perLabel[0]); the rest get one task per label
+      const bool whole = strategy_->singlePass();
+      const std::size_t labels = whole ? 1 : slot->census.labelCount();
+      slot->perLabel.resize(labels);
+      for (auto& blocks : slot->perLabel) blocks.clear();
+
+      std::size_t tasks = whole ? 1 : 0;
+      for (uint32_t labelId = 0; !whole && labelId < labels; ++labelId)
+        tasks += slot->census.contains(labelId);
+      {
+        std::lock_guard<std::mutex> lock(mtx);
+        slot->remaining = tasks;
+      }
+      auto task = [this, slot, whole, &mtx, &cv](uint32_t labelId) {
+        std::exception_ptr error;
+        try {
+          if (whole) {
+            strategy_->coverAll(*slot->parent, slot->perLabel[0]);
+          } else {
+            strategy_->cover(*slot->parent, labelId, slot->perLabel[labelId]);
+          }
+        } catch (...) {
+          error = std::current_exception();
+        }
+        // Notify under the lock: the waiter may return and destroy cv
+        std::lock_guard<std::mutex> lock(mtx);
+        if (error && !slot->error) slot->error = error;
+        if (--slot->remaining == 0) cv.notify_all();
+      };
+      for (uint32_t labelId = 0; labelId < labels; ++labelId) {
+        if (!whole && !slot->census.contains(labelId)) continue;
+        pool_.submit([task, labelId] { task(labelId); });
+      }
+      ++next;
+    }
+    while (head < next) commit();
+  } catch (...) {
+    // Tasks still reference the slots; let them finish first
+    for (std::size_t i = head; i < next; ++i) wait(*slots[i % slots.size()]);
+    throw;
+  }
+}
+
+PipelineWorker::PipelineWorker(std::unique_ptr<WorkerBackend> inner,
+                               std::size_t compressors, std::size_t depth)
+    : inner_(std::move(inner)), compressors_(compressors), depth_(depth) {
+  if (compressors_ == 0)
+    compressors_ = std::max(1u, std::thread::hardware_concurrency());
+  if (depth_ == 0) depth_ = 2 * compressors_;
+}
+
+std::vector<BlockDesc> PipelineWorker::process(const ParentBlock& parent,
+                                               uint32_t labelId) {
+  return inner_ ? inner_->process(parent, labelId) : std::vector<BlockDesc>{};
+}
+
+void PipelineWorker::coverAll(const ParentBlock& parent,
+                              std::vector<BlockDesc>& out) {
+  if (inner_) inner_->coverAll(parent, out);
+}
+
+void PipelineWorker::compress(IO::Endpoint& ep) {
+  if (!inner_) return;
+
+  // Slots are recycled through the queues by index, so neither grids nor
+  // block vectors are reallocated once the pipeline is warm
+  struct Slot {
+    Model::Grid grid;
+    Model::Census census;
+    std::unique_ptr<ParentBlock> parent;
+    std::vector<BlockDesc> blocks;
+    std::size_t seq{0};
+
+    explicit Slot(Model::Grid g) : grid(std::move(g)) {}
+  };
+  const std::size_t depth = depth_;
+  std::vector<std::unique_ptr<Slot>> slots;
+  for (std::size_t i = 0; i < depth; ++i)
+    slots.push_back(std::make_unique<Slot>(ep.newParentGrid()));
+
+  constexpr uint32_t kEnd = UINT32_MAX;
+  Parallel::BoundedQueue<uint32_t> freeSlots(depth);
+  Parallel::BoundedQueue<uint32_t> toCover(depth + compressors_);
+  Parallel::BoundedQueue<uint32_t> toWrite(depth + compressors_);
+  for (uint32_t i = 0; i < depth; ++i) freeSlots.tryPush(i);
+
+  // First error stops every stage; waits give up once it is set
+  std::atomic<bool> failed{false};
+  std::mutex errorMtx;
+  std::exception_ptr error;
+  auto fail = [&]() {
+    std::lock_guard<std::mutex> lock(errorMtx);
+    if (!error) error = std::current_exception();
+    failed.store(true, std::memory_order_release);
+  };
+  auto push = [&](Parallel::BoundedQueue<uint32_t>& q, uint32_t v) {
+    Parallel::Backoff backoff;
+    while (!q.tryPush(v)) {
+      if (failed.load(std::memory_order_acquire)) return false;
+      backoff.pause();
+    }
+    return true;
+  };
+  auto pop = [&](Parallel::BoundedQueue<uint32_t>& q, uint32_t& v) {
+    Parallel::Backoff backoff;
+    while (!q.tryPop(v)) {
+      if (failed.load(std::memory_order_acquire)) return false;
+      backoff.pause();
+    }
+    return true;
+  };
+
+  std::thread reader([&] {
+    try {
+      for (std::size_t seq = 0; ep.hasNextParent(); ++seq) {
+        uint32_t id;
+        if (!pop(freeSlots, id)) return;
+        Slot& slot = *slots[id];
+        slot.parent =
+            std::make_unique<ParentBlock>(ep.nextParent(slot.grid, slot.census));
+        slot.seq = seq;
+        if (!push(toCover, id)) return;
+      }
+      for (std::size_t i = 0; i < compressors_; ++i)
+        if (!push(toCover, kEnd)) return;
+    } catch (...) {
+      fail();
+    }
+  });
+
+  std::vector<std::thread> compressors;
+  for (std::size_t t = 0; t < compressors_; ++t) {
+    compressors.emplace_back([&] {
+      try {
+        uint32_t id;
+        while (pop(toCover, id)) {
+          if (id != kEnd) {
+            Slot& slot = *slots[id];
+            slot.blocks.clear();
+            inner_->coverAll(*slot.parent, slot.blocks);
+          }
+          if (!push(toWrite, id) || id == kEnd) return;
+        }
+      } catch (...) {
+        fail();
+      }
+    });
+  }
+
+  // Writer: restore input order; parent seq can only be in slot-ring
+  // position seq % depth since at most depth parents are in flight
+  try {
+    std::vector<uint32_t> ready(depth, kEnd);
+    std::size_t nextSeq = 0;
+    std::size_t ended = 0;
+    uint32_t id;
+    while (ended < compressors_ && pop(toWrite, id)) {
+      if (id == kEnd) {
+        ++ended;
+        continue;
+      }
+      ready[slots[id]->seq % depth] = id;
+      while (ready[nextSeq % depth] != kEnd) {
+        const uint32_t done = ready[nextSeq % depth];
+        ready[nextSeq % depth] = kEnd;
+        Slot& slot = *slots[done];
+        ep.write(slot.blocks);
+        slot.parent.reset();
+        ++nextSeq;
+        if (!push(freeSlots, done)) break;
+      }
+    }
+  } catch (...) {
+    fail();
+  }
+
+  reader.join();
+  for (auto& t : compressors) t.join();
+  if (error) std::rethrow_exception(error);
+}
+
+};  // namespace Worker
@@ -1,50 +1,147 @@
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
 #include <iostream>
+#include <limits>
 #include <sstream>
+#include <string>
 #include "IO.hpp"
 #include "Model.hpp"
 #include "Strategy.hpp"
+#include "Worker.hpp"
 
 using Model::BlockDesc;
 
-int main() {
-    // std::ios::sync_with_stdio(false);
-    // std::cin.tie(nullptr);
-    // IO::Endpoint ep(std::cin, std::cout);
-    // ep.init();
+static int run(int argc, char** argv) {
+    // Options:
+    //   --prefetch N   read N chunks ahead on a background thread
+    //   --binary       write the compact binary format (see bin/decode)
+    //   --ingest-threads N  parse memory-mapped input on N threads
+    //   --index PATH   slice index sidecar (built and saved if missing, stale or
+    //                  too short for --z-range)
+    //   --z-range A:B  only process slices [A, B) (regular input files)
+    //   --stack-z      merge identical groups across slices of a parent
+    //   --threads N    cover whole parents on N threads (0 = all cores)
+    //                  instead of streaming rows through StreamRLEXY
+    //   --pipeline     cover parents with reading, covering and writing
+    //                  overlapped in bounded memory (implies parent mode)
+    //   --strategy S   parent strategy: greedy (default) or smart
+    int prefetch = 0;
+    int ingestThreads = 1;
+    bool binary = false;
+    bool stackZ = false;
+    int threads = -1;  // unset: stream rows unless --pipeline is given
+    bool pipeline = false;
+    std::string strategy = "greedy";
+    std::string indexPath;
+    int zBegin = -1, zEnd = -1;
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        if (arg == "--prefetch" && i + 1 < argc) {
+            prefetch = std::atoi(argv[++i]);
+        } else if (arg == "--ingest-threads" && i + 1 < argc) {
+            ingestThreads = std::atoi(argv[++i]);
+        } else if (arg == "--index" && i + 1 < argc) {
+            indexPath = argv[++i];
+        } else if (arg == "--z-range" && i + 1 < argc) {
+            const std::string range = argv[++i];
+            const size_t colon = range.find(':');
+            if (colon == std::string::npos) {
+                std::cerr << "--z-range expects A:B\n";
+                return 1;
+            }
+            zBegin = std::atoi(range.substr(0, colon).c_str());
+            zEnd = std::atoi(range.substr(colon + 1).c_str());
+        } else if (arg == "--binary") {
+            binary = true;
+        } else if (arg == "--stack-z") {
+            stackZ = true;
+        } else if (arg == "--threads" && i + 1 < argc) {
+            threads = std::max(0, std::atoi(argv[++i]));
+        } else if (arg == "--pipeline") {
+            pipeline = true;
+        } else if (arg == "--strategy" && i + 1 < argc) {
+            strategy = argv[++i];
+            if (strategy != "greedy" && strategy != "smart") {
+                std::cerr << "--strategy expects greedy or smart\n";
+                return 1;
+            }
+        }
+    }
 
-    // const Model::LabelTable& lt = ep.labels();
-    // Strategy::GreedyStrat strat;  // SmartMerge: Best compression with practical speed
-
-    // while (ep.hasNextParent()) {
-    //     Model::ParentBlock parent = ep.nextParent();
-
-    //     // Collect all blocks from all labels
-    //     std::vector<std::vector<BlockDesc>> allLabelBlocks;
-    //     allLabelBlocks.reserve(lt.size());
-
-    //     for (uint32_t labelId = 0; labelId < lt.size(); ++labelId) {
-    //         std::vector<BlockDesc> blocks = strat.cover(parent, labelId);
-    //         allLabelBlocks.push_back(std::move(blocks));
-    //     }
-
-    //     // Write all blocks (cross-label optimization happens in strategy)
-    //     for (const auto& blocks : allLabelBlocks) {
-    //         ep.write(blocks);
-    //     }
-    // }
+    std::ios::sync_with_stdio(false);
+    std::cin.tie(nullptr);
 
-    // ep.flush();
-    // return 0;
+    // Regular files on stdin are memory-mapped; pipes fall back to std::cin
+    std::unique_ptr<IO::Endpoint> ep;
+    if (auto mapped = IO::MappedFile::open(0)) {
+        ep = std::make_unique<IO::Endpoint>(std::move(mapped), std::cout);
+    } else {
+        ep = std::make_unique<IO::Endpoint>(std::cin, std::cout);
+    }
+    ep->setPrefetch(prefetch);
+    ep->setIngestThreads(static_cast<size_t>(std::max(1, ingestThreads)));
+    if (binary) ep->setOutputFormat(IO::OutputFormat::Binary);
+    ep->setStackZ(stackZ);
+    ep->init();
 
-    // UNCOMMENT THE CODE BELOW TO RUN STREAMRLEXY ALGORITHM
+    if (!indexPath.empty() || zBegin >= 0) {
+        // A Z window only needs the index up to its end; a saved index that
+        // stops short of it (built for an earlier window) is extended
+        // A saved index that no longer matches the input is rebuilt too
+        const int needed = zBegin >= 0 ? zEnd : std::numeric_limits<int>::max();
+        IO::SliceIndex index;
+        std::ifstream saved(indexPath, std::ios::binary);
+        if (saved) index = IO::SliceIndex::load(saved);
+        if (!saved || (zBegin >= 0 && (index.slices() < needed ||
+                                       !ep->indexMatches(index, zBegin, zEnd)))) {
+            index = ep->buildSliceIndex(needed);
+            if (!indexPath.empty()) {
+                std::ofstream sidecar(indexPath, std::ios::binary);
+                index.save(sidecar);
+            }
+        }
+        if (zBegin >= 0) ep->setZWindow(index, zBegin, zEnd);
+    }
 
-    std::ios::sync_with_stdio(false);
-    std::cin.tie(nullptr);
-    IO::Endpoint ep(std::cin, std::cout);
-    ep.init();
+    if (threads >= 0 || pipeline) {
+        // Parent mode: all labels of each parent covered in one pass,
+        // written in input order
+        auto makeStrategy = [&]() -> std::unique_ptr<Strategy::GroupingStrategy> {
+            if (strategy == "smart")
+                return std::make_unique<Strategy::SmartMergeStrat>();
+            return std::make_unique<Strategy::GreedyStrat>();
+        };
+        std::unique_ptr<Worker::WorkerBackend> worker;
+        if (threads == 1) {
+            worker = std::make_unique<Worker::DirectWorker>(makeStrategy());
+        } else {
+            worker = std::make_unique<Worker::ThreadWorker>(
+                makeStrategy(), static_cast<size_t>(std::max(0, threads)));
+        }
+        if (pipeline) {
+            // One compressor stage per covering worker; a thread pool is
+            // kept busy by two
+            const size_t compressors = threads == 1 ? 1 : 2;
+            worker = std::make_unique<Worker::PipelineWorker>(std::move(worker),
+                                                              compressors);
+        }
+        worker->compress(*ep);
+        ep->flush();
+        return 0;
+    }
 
     // Use StreamRLEXY for infinite streaming!
-    ep.emitRLEXY();
+    ep->emitRLEXY();
 
     return 0;
 }
+
+int main(int argc, char** argv) {
+    try {
+        return run(argc, argv);
+    } catch (const std::exception& ex) {
+        std::cerr << "compressor: " << ex.what() << "\n";
+        return 1;
+    }
+}
@@ -0,0 +1,14 @@
+#include <iostream>
+#include "IO.hpp"
+
+// Convert the binary output of `compressor --binary` back to CSV
+int main() {
+    std::ios::sync_with_stdio(false);
+    try {
+        IO::binaryToCsv(std::cin, std::cout);
+    } catch (const std::exception& ex) {
+        std::cerr << "decode: " << ex.what() << "\n";
+        return 1;
+    }
+    return 0;
+}
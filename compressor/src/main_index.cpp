@@ -0,0 +1,22 @@
+#include <iostream>
+#include "IO.hpp"
+
+// Build the slice index sidecar for a model file:
+//   bin/index < model.csv > model.csv.idx
+// The compressor uses it with --index / --z-range to seek to a Z window.
+int main() {
+    try {
+        auto mapped = IO::MappedFile::open(0);
+        if (!mapped) {
+            std::cerr << "index: stdin must be a regular file\n";
+            return 1;
+        }
+        IO::Endpoint ep(std::move(mapped), std::cout);
+        ep.init();
+        ep.buildSliceIndex().save(std::cout);
+    } catch (const std::exception& ex) {
+        std::cerr << "index: " << ex.what() << "\n";
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,31 @@
+#include <iostream>
+#include <string>
+#include "IO.hpp"
+
+// Convert a text block model to the packed binary model format, which the
+// compressor reads without text parsing or tag validation.
+//   --raw   store rows uncompressed (default: per-row RLE when smaller)
+int main(int argc, char** argv) {
+    std::ios::sync_with_stdio(false);
+    std::cin.tie(nullptr);
+
+    bool rle = true;
+    for (int i = 1; i < argc; ++i) {
+        if (std::string(argv[i]) == "--raw") rle = false;
+    }
+
+    try {
+        std::unique_ptr<IO::Endpoint> ep;
+        if (auto mapped = IO::MappedFile::open(0)) {
+            ep = std::make_unique<IO::Endpoint>(std::move(mapped), std::cout);
+        } else {
+            ep = std::make_unique<IO::Endpoint>(std::cin, std::cout);
+        }
+        ep->init();
+        ep->emitPacked(rle);
+    } catch (const std::exception& ex) {
+        std::cerr << "pack: " << ex.what() << "\n";
+        return 1;
+    }
+    return 0;
+}
@@ -7,11 +7,18 @@
 int main() {
     std::ios::sync_with_stdio(false);
     std::cin.tie(nullptr);
-    IO::Endpoint ep(std::cin, std::cout);
-    ep.init();
+
+    // Regular files on stdin are memory-mapped; pipes fall back to std::cin
+    std::unique_ptr<IO::Endpoint> ep;
+    if (auto mapped = IO::MappedFile::open(0)) {
+        ep = std::make_unique<IO::Endpoint>(std::move(mapped), std::cout);
+    } else {
+        ep = std::make_unique<IO::Endpoint>(std::cin, std::cout);
+    }
+    ep->init();
 
     // Use StreamRLEXY for ultra-fast line-by-line streaming!
-    ep.emitRLEXY();
+    ep->emitRLEXY();
 
     return 0;
 }
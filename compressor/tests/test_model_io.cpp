@@ -1,12 +1,19 @@
+#include <algorithm>
 #include <cassert>
+#include <cstdio>
 #include <iostream>
 #include <sstream>
+#include <stdexcept>
 #include <string>
 #include <vector>
 
 #include "../include/IO.hpp"
 #include "../include/Model.hpp"
 
+#if defined(IO_HAVE_ZLIB)
+#include <zlib.h>
+#endif
+
 using Model::BlockDesc;
 using Model::Grid;
 using Model::LabelTable;
@@ -15,7 +22,7 @@ using Model::ParentBlock;
 // ------------------------------
 // Debug helpers (print only if TEST_VERBOSE is defined)
 // ------------------------------
-static void dump_parent_block(const Model::ParentBlock& p) {
+static void dump_parent_block([[maybe_unused]] const Model::ParentBlock& p) {
 #ifdef TEST_VERBOSE
   std::cout << "Parent origin=(" << p.originX() << "," << p.originY() << ","
             << p.originZ() << "), size=(" << p.sizeX() << "x" << p.sizeY()
@@ -32,8 +39,9 @@ static void dump_parent_block(const Model::ParentBlock& p) {
 #endif
 }
 
-static void print_blocks(const std::vector<Model::BlockDesc>& blocks,
-                         const Model::LabelTable& lt) {
+static void print_blocks(
+    [[maybe_unused]] const std::vector<Model::BlockDesc>& blocks,
+    [[maybe_unused]] const Model::LabelTable& lt) {
 #ifdef TEST_VERBOSE
   std::cout << "Emitted blocks (" << blocks.size() << "):\n";
   for (const auto& b : blocks) {
@@ -83,6 +91,41 @@ static void test_label_table_basic() {
   assert(lt.size() == 2);
 }
 
+static void test_label_table_translate() {
+  LabelTable lt;
+  lt.add('a', "rock");
+  lt.add('b', "ore");
+
+  // Long enough to exercise the vector path, uniform and mixed spans
+  std::string row(40, 'a');
+  row[33] = 'b';
+  std::vector<uint8_t> ids(row.size());
+  assert(lt.translate(row.data(), row.size(), ids.data()) == row.size());
+  for (size_t i = 0; i < row.size(); ++i)
+    assert(ids[i] == (i == 33 ? 1u : 0u));
+
+  // First unknown column is reported
+  row[21] = '?';
+  row[37] = '!';
+  assert(lt.translate(row.data(), row.size(), ids.data()) == 21u);
+}
+
+static void test_run_starts() {
+  // Lengths around the 16/32-cell vector steps and the 64-bit word edge
+  for (size_t n : {1u, 15u, 17u, 33u, 64u, 65u, 130u}) {
+    std::vector<uint8_t> ids(n);
+    for (size_t i = 0; i < n; ++i) ids[i] = static_cast<uint8_t>((i / 7) % 3);
+    if (n > 64) ids[64] = 9;
+    std::vector<uint64_t> bits((n + 63) / 64, ~0ull);
+    Model::runStarts(ids.data(), n, bits.data());
+    for (size_t i = 0; i < n; ++i) {
+      const bool start = i == 0 || ids[i] != ids[i - 1];
+      assert(((bits[i >> 6] >> (i & 63)) & 1u) == start);
+    }
+    if (n & 63) assert((bits.back() >> (n & 63)) == 0);
+  }
+}
+
 static void test_grid_indexing() {
   Grid g(4, 3, 2);
   // write some positions
@@ -96,6 +139,64 @@ static void test_grid_indexing() {
   assert(g.size() == static_cast<size_t>(4 * 3 * 2));
 }
 
+static void test_grid_nibble_cells() {
+  assert(Grid::widthFor(16) == Model::CellWidth::Nibble);
+  assert(Grid::widthFor(17) == Model::CellWidth::Byte);
+  Grid g(3, 3, 1, Model::CellWidth::Nibble);
+  assert(g.size() == 9u);
+  assert(g.bytes() == 5u);
+  g.at(1, 0, 0) = 15;
+  g.at(2, 0, 0) = 4;
+  assert(g.at(0, 0, 0) == 0);
+  assert(g.at(1, 0, 0) == 15);
+  assert(g.at(2, 0, 0) == 4);
+  // Row starting on an odd cell
+  const uint8_t ids[3] = {1, 2, 3};
+  g.setRow(0, 1, 0, ids, 3);
+  assert(g.at(0, 1, 0) == 1 && g.at(1, 1, 0) == 2 && g.at(2, 1, 0) == 3);
+  assert(g.at(2, 0, 0) == 4);
+  g.setRow(0, 2, 0, ids, 3);
+  assert(g.at(2, 2, 0) == 3);
+}
+
+static void test_parent_block_planes() {
+  for (auto width : {Model::CellWidth::Byte, Model::CellWidth::Nibble}) {
+    Grid g(70, 2, 2, width);
+    for (int x = 0; x < 70; ++x) g.at(x, 0, 0) = 3;
+    g.at(65, 1, 1) = 2;
+    ParentBlock p(0, 0, 0, g);
+    const Model::BitPlanes& planes = p.planes();
+    assert(&planes == &p.planes());  // cached
+    assert(planes.wordsPerRow() == 2u);
+    assert(planes.row(3, 0, 0)[0] == ~0ull);
+    assert(planes.row(3, 0, 0)[1] == 0x3Fu);
+    assert(planes.test(2, 65, 1, 1) && !planes.test(2, 64, 1, 1));
+    assert(planes.test(0, 0, 1, 0));
+    assert(!planes.test(200, 0, 0, 0));
+  }
+}
+
+static void test_parent_block_census() {
+  Grid g(4, 3, 2);
+  g.at(1, 1, 1) = 2;
+  g.at(2, 2, 1) = 2;
+  ParentBlock p(0, 0, 0, g);
+  const Model::Census& c = p.census();
+  assert(c.box(0).count == 22u && !c.box(0).solid());
+  const Model::LabelBox& b = c.box(2);
+  assert(b.count == 2u && b.volume() == 4u && !b.solid());
+  assert(b.x0 == 1 && b.x1 == 3 && b.y0 == 1 && b.y1 == 3);
+  assert(b.z0 == 1 && b.z1 == 2);
+  assert(!c.contains(1) && !c.contains(9));
+
+  // Writes show up only after an explicit invalidate()
+  assert(p.planes().test(0, 0, 0, 0));
+  p.grid().at(0, 0, 0) = 1;
+  assert(!p.census().contains(1) && !p.planes().test(1, 0, 0, 0));
+  p.invalidate();
+  assert(p.census().box(1).count == 1u && p.planes().test(1, 0, 0, 0));
+}
+
 static void test_parent_block_wrap() {
   Grid g(2, 3, 1);
   ParentBlock p(10, 20, 30, g);
@@ -177,6 +278,7 @@ static void test_io_write_format() {
   blocks.push_back(BlockDesc{2, 1, 0, 2, 2, 1, 1});  // ore
 
   ep.write(blocks);
+  ep.flush();  // write() buffers until the flush threshold
 
   const std::string s = out.str();
   std::istringstream check(s);
@@ -189,17 +291,217 @@ static void test_io_write_format() {
   print_blocks(blocks, ep.labels());
 }
 
+static void test_io_mapped_input_matches_stream() {
+  const std::string content = minimal_input_2x3x1_parent_2x3x1();
+  std::FILE* tmp = std::tmpfile();
+  assert(tmp);
+  std::fwrite(content.data(), 1, content.size(), tmp);
+  std::fflush(tmp);
+  std::rewind(tmp);
+
+  auto mapped = IO::MappedFile::open(fileno(tmp));
+  assert(mapped);
+  std::ostringstream out;
+  IO::Endpoint ep(std::move(mapped), out);
+  ep.init();
+  assert(ep.labels().size() == 2);
+
+  int parents = 0;
+  while (ep.hasNextParent()) {
+    Model::ParentBlock p = ep.nextParent();
+    const uint32_t expect = (p.originX() == 0) ? 0u : 1u;
+    for (int y = 0; y < p.sizeY(); ++y)
+      for (int x = 0; x < p.sizeX(); ++x)
+        assert(p.grid().at(x, y, 0) == expect);
+    // Census gathered by the reader: the parent is one solid label
+    assert(p.census().box(expect).solid());
+    assert(!p.census().contains(1u - expect));
+    ++parents;
+  }
+  assert(parents == 2);
+  std::fclose(tmp);
+}
+
+static void test_io_slice_index_window() {
+  // W=2,H=1,D=3 ; parent=2x1x1 ; slice z is all 'a' except z=2 ('b')
+  const std::string content =
+      "2,1,3,2,1,1\na, rock\nb, ore\n\naa\n\naa\n\nbb\n";
+  std::FILE* tmp = std::tmpfile();
+  assert(tmp);
+  std::fwrite(content.data(), 1, content.size(), tmp);
+  std::fflush(tmp);
+
+  std::ostringstream out;
+  IO::Endpoint ep(IO::MappedFile::open(fileno(tmp)), out);
+  ep.init();
+  const IO::SliceIndex index = ep.buildSliceIndex();
+  assert(index.slices() == 3);
+  assert(index.fileSize == content.size());
+
+  // A bounded scan stops early and agrees with the full index so far
+  const IO::SliceIndex partial = ep.buildSliceIndex(2);
+  assert(partial.slices() == 2);
+  assert(partial.checksums[1] == index.checksums[1]);
+  assert(partial.offsets.back() == index.offsets[2]);
+
+  std::stringstream saved;
+  index.save(saved);
+  const IO::SliceIndex loaded = IO::SliceIndex::load(saved);
+  assert(loaded.offsets == index.offsets);
+  assert(loaded.checksums == index.checksums);
+
+  // Every slice of the window is checked, not only the first
+  assert(ep.indexMatches(loaded, 1, 3));
+  IO::SliceIndex stale = loaded;
+  stale.checksums[2] ^= 1u;
+  assert(ep.indexMatches(stale, 0, 2));
+  assert(!ep.indexMatches(stale, 1, 3));
+  bool threw = false;
+  try {
+    ep.setZWindow(stale, 1, 3);
+  } catch (const std::runtime_error&) {
+    threw = true;
+  }
+  assert(threw);
+
+  ep.setZWindow(loaded, 2, 3);
+  assert(ep.hasNextParent());
+  Model::ParentBlock p = ep.nextParent();
+  assert(p.originZ() == 2);
+  assert(p.grid().at(0, 0, 0) == 1u);
+  assert(!ep.hasNextParent());
+  std::fclose(tmp);
+}
+
+static void test_io_stream_stack_z() {
+  // W=2,H=1,D=4 ; parent depth 2 ; 'a' in z=0..2, 'b' in z=3
+  const std::string content =
+      "2,1,4,2,1,2\na, rock\nb, ore\n\naa\n\naa\n\naa\n\nbb\n";
+  for (bool stack : {false, true}) {
+    std::istringstream in(content);
+    std::ostringstream out;
+    IO::Endpoint ep(in, out);
+    ep.setStackZ(stack);
+    ep.emitRLEXY();
+    const std::string text = out.str();
+    const size_t lines =
+        static_cast<size_t>(std::count(text.begin(), text.end(), '\n'));
+    if (stack) {
+      // z=0..1 stack; z=2 starts a new parent-Z window
+      assert(lines == 3u);
+      assert(text.find("0,0,0,2,1,2,rock\n") != std::string::npos);
+      assert(text.find("0,0,2,2,1,1,rock\n") != std::string::npos);
+    } else {
+      assert(lines == 4u);
+    }
+    assert(text.find("0,0,3,2,1,1,ore\n") != std::string::npos);
+  }
+}
+
+#if defined(IO_HAVE_ZLIB)
+static std::string gzip_string(const std::string& raw) {
+  z_stream zs{};
+  deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 16 + MAX_WBITS, 8,
+               Z_DEFAULT_STRATEGY);
+  std::string out(deflateBound(&zs, raw.size()), '\0');
+  zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(raw.data()));
+  zs.avail_in = static_cast<uInt>(raw.size());
+  zs.next_out = reinterpret_cast<Bytef*>(&out[0]);
+  zs.avail_out = static_cast<uInt>(out.size());
+  deflate(&zs, Z_FINISH);
+  out.resize(zs.total_out);
+  deflateEnd(&zs);
+  return out;
+}
+
+static void test_io_gzip_input() {
+  std::istringstream in(gzip_string(minimal_input_2x3x1_parent_2x3x1()));
+  std::ostringstream out;
+  IO::Endpoint ep(in, out);
+  ep.init();
+  assert(ep.labels().size() == 2);
+
+  int parents = 0;
+  while (ep.hasNextParent()) {
+    Model::ParentBlock p = ep.nextParent();
+    const uint32_t expect = (p.originX() == 0) ? 0u : 1u;
+    assert(p.grid().at(1, 2, 0) == expect);
+    ++parents;
+  }
+  assert(parents == 2);
+}
+#endif
+
+static void test_io_binary_output_roundtrip() {
+  std::istringstream in(minimal_input_2x3x1_parent_2x3x1());
+  std::ostringstream bin;
+  IO::Endpoint ep(in, bin);
+  ep.init();
+  ep.setOutputFormat(IO::OutputFormat::Binary);
+
+  std::vector<BlockDesc> blocks;
+  blocks.push_back(BlockDesc{0, 0, 0, 2, 3, 1, 0});  // rock, parent 0
+  blocks.push_back(BlockDesc{2, 1, 0, 2, 2, 1, 1});  // ore, parent 1
+  blocks.push_back(BlockDesc{3, 0, 0, 1, 1, 1, 1});  // ore, parent 1
+  ep.write(blocks);
+  ep.flush();
+
+  std::istringstream binIn(bin.str());
+  std::ostringstream csv;
+  IO::binaryToCsv(binIn, csv);
+  assert(csv.str() ==
+         "0,0,0,2,3,1,rock\n2,1,0,2,2,1,ore\n3,0,0,1,1,1,ore\n");
+}
+
+static void test_io_packed_input_roundtrip() {
+  for (bool rle : {true, false}) {
+    std::istringstream text(minimal_input_2x3x1_parent_2x3x1());
+    std::ostringstream packed;
+    {
+      IO::Endpoint conv(text, packed);
+      conv.init();
+      conv.emitPacked(rle);
+    }
+
+    std::istringstream in(packed.str());
+    std::ostringstream out;
+    IO::Endpoint ep(in, out);
+    ep.init();
+    assert(ep.labels().size() == 2);
+    assert(ep.labels().getName(1) == std::string("ore"));
+
+    Model::ParentBlock p0 = ep.nextParent();
+    assert(p0.originX() == 0 && p0.grid().at(1, 2, 0) == 0u);
+    Model::ParentBlock p1 = ep.nextParent();
+    assert(p1.originX() == 2 && p1.grid().at(0, 0, 0) == 1u);
+    assert(!ep.hasNextParent());
+  }
+}
+
 // ------------------------------
 // Main
 // ------------------------------
 int main() {
   test_label_table_basic();
+  test_label_table_translate();
+  test_run_starts();
   test_grid_indexing();
+  test_grid_nibble_cells();
   test_parent_block_wrap();
+  test_parent_block_planes();
+  test_parent_block_census();
 
   test_io_init_and_parse();
   test_io_parent_iteration_and_content();
   test_io_write_format();
+  test_io_mapped_input_matches_stream();
+  test_io_slice_index_window();
+  test_io_stream_stack_z();
+#if defined(IO_HAVE_ZLIB)
+  test_io_gzip_input();
+#endif
+  test_io_binary_output_roundtrip();
+  test_io_packed_input_roundtrip();
 
   std::cout << "[OK] Model & IO basic tests passed\n";
   return 0;
@@ -1,13 +1,21 @@
+#include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <chrono>
 #include <fstream>
+#include <future>
 #include <iostream>
 #include <sstream>
+#include <stdexcept>
 #include <string>
+#include <thread>
 #include <vector>
 
 #include "IO.hpp"
 #include "Model.hpp"
+#include "Parallel.hpp"
 #include "Strategy.hpp"
+#include "Worker.hpp"
 
 using Model::BlockDesc;
 
@@ -34,8 +42,59 @@ static void print_blocks_csv(const std::vector<BlockDesc>& blocks,
   }
 }
 
+// Nested loops, exceptions and uneven work on the work-stealing pool
+static void test_stealing_pool() {
+  Parallel::StealingPool pool(3);
+
+  // Two levels of nested parallelFor inside a pool task
+  std::atomic<size_t> cells{0};
+  std::promise<bool> nested;
+  pool.submit([&] {
+    const bool onPool = Parallel::StealingPool::current() == &pool;
+    Parallel::parallelFor(8, [&](size_t) {
+      Parallel::parallelFor(16, [&](size_t) { ++cells; });
+    });
+    nested.set_value(onPool);
+  });
+  if (!nested.get_future().get())
+    throw std::runtime_error("StealingPool task not on a pool thread");
+  if (cells.load() != 8 * 16)
+    throw std::runtime_error("nested parallelFor ran the wrong iterations");
+
+  // An exception from a nested loop reaches the outermost caller
+  bool caught = false;
+  try {
+    pool.parallelFor(4, [&](size_t i) {
+      Parallel::parallelFor(4, [&](size_t j) {
+        if (i == 2 && j == 3) throw std::logic_error("nested");
+      });
+    });
+  } catch (const std::logic_error&) {
+    caught = true;
+  }
+  if (!caught) throw std::runtime_error("nested exception was lost");
+
+  // Uneven iterations all finish, and pool threads share them: the caller
+  // holds its first iteration until a pool thread has finished one, so
+  // this does not depend on scheduling
+  std::atomic<size_t> done{0}, onPool{0};
+  const std::thread::id caller = std::this_thread::get_id();
+  pool.parallelFor(64, [&](size_t i) {
+    if (std::this_thread::get_id() == caller) {
+      while (onPool.load() == 0) std::this_thread::yield();
+    }
+    std::this_thread::sleep_for(std::chrono::microseconds(i % 8 ? 20 : 500));
+    if (std::this_thread::get_id() != caller) ++onPool;
+    ++done;
+  });
+  if (done.load() != 64 || onPool.load() == 0)
+    throw std::runtime_error("uneven parallelFor did not share iterations");
+}
+
 int main() {
   try {
+    test_stealing_pool();
+
     // Load file content
     std::ifstream f("tests/input.txt");
     if (!f) {
@@ -56,6 +115,23 @@ int main() {
 
     Strategy::DefaultStrat naive;
     Strategy::GreedyStrat greedy;
+    Strategy::RLEXYStrat rlexy;
+    Strategy::SmartMergeStrat smart;
+
+    // mergeBlocks folds a 2x2x2 lattice of unit cubes into one block and
+    // leaves a different label alone
+    {
+      std::vector<BlockDesc> cubes;
+      for (int z = 0; z < 2; ++z)
+        for (int y = 0; y < 2; ++y)
+          for (int x = 0; x < 2; ++x)
+            cubes.push_back(BlockDesc{x, y, z, 1, 1, 1, 0});
+      cubes.push_back(BlockDesc{2, 0, 0, 1, 2, 2, 1});
+      const std::vector<BlockDesc> merged = Strategy::mergeBlocks(cubes);
+      if (merged.size() != 2 || merged[0].dx != 2 || merged[0].dy != 2 ||
+          merged[0].dz != 2 || merged[1].labelId != 1)
+        throw std::runtime_error("mergeBlocks did not fold the lattice");
+    }
 
     int parentIndex = 0;
     while (ep.hasNextParent()) {
@@ -66,6 +142,25 @@ int main() {
                 << " size=(" << p.sizeX() << "x" << p.sizeY() << "x"
                 << p.sizeZ() << ")\n";
 
+      // coverAll must match the per-label cover() loop block for block
+      for (Strategy::GroupingStrategy* strat :
+           {static_cast<Strategy::GroupingStrategy*>(&greedy),
+            static_cast<Strategy::GroupingStrategy*>(&rlexy)}) {
+        std::vector<BlockDesc> perLabel, all;
+        for (uint32_t labelId = 0; labelId < lt.size(); ++labelId) {
+          std::vector<BlockDesc> blocks = strat->cover(p, labelId);
+          perLabel.insert(perLabel.end(), blocks.begin(), blocks.end());
+        }
+        strat->coverAll(p, all);
+        const auto same = [](const BlockDesc& a, const BlockDesc& b) {
+          return a.x == b.x && a.y == b.y && a.z == b.z && a.dx == b.dx &&
+                 a.dy == b.dy && a.dz == b.dz && a.labelId == b.labelId;
+        };
+        if (!std::equal(perLabel.begin(), perLabel.end(), all.begin(),
+                        all.end(), same))
+          throw std::runtime_error("coverAll differs from per-label cover");
+      }
+
       // For each label id present in the label table
       for (uint32_t labelId = 0; labelId < lt.size(); ++labelId) {
         const std::string& lname = lt.getName(labelId);
@@ -96,12 +191,54 @@ int main() {
 
         print_blocks_csv(greedyBlocks, lt, "GreedyStrat blocks");
 
+        // No cover beats the lower bound; SmartMerge never loses to Greedy
+        const size_t bound = Strategy::coverLowerBound(p, labelId);
+        const size_t smartCount = smart.cover(p, labelId).size();
+        if (bound > greedyBlocks.size() || bound > smartCount)
+          throw std::runtime_error("cover below the lower bound");
+        if (smartCount > greedyBlocks.size())
+          throw std::runtime_error("SmartMerge worse than Greedy");
+
         std::cout << "Summary for label '" << lname << "': cells=" << cells
                 //   << " | naiveCount=" << naiveBlocks.size()
-                  << " | greedyCount=" << greedyBlocks.size() << "\n\n";
+                  << " | greedyCount=" << greedyBlocks.size()
+                  << " | smartCount=" << smartCount << " | bound=" << bound
+                  << "\n\n";
       }
     }
 
+    // ThreadWorker and PipelineWorker cover parents concurrently but must
+    // write exactly what the sequential path writes
+    std::string written[3];
+    for (int mode = 0; mode < 3; ++mode) {
+      std::istringstream input(content);
+      std::ostringstream output;
+      IO::Endpoint endpoint(input, output);
+      endpoint.init();
+      auto strat = std::make_unique<Strategy::SmartMergeStrat>();
+      if (mode == 1) {
+        Worker::ThreadWorker(std::move(strat), 3).compress(endpoint);
+      } else if (mode == 2) {
+        // Fewer slots than compressors keeps the pipeline under backpressure
+        Worker::PipelineWorker(
+            std::make_unique<Worker::DirectWorker>(std::move(strat)), 3, 2)
+            .compress(endpoint);
+      } else {
+        Worker::DirectWorker(std::move(strat)).compress(endpoint);
+      }
+      endpoint.flush();
+      written[mode] = output.str();
+    }
+    if (written[0].empty() || written[0] != written[1])
+      throw std::runtime_error("ThreadWorker output differs from DirectWorker");
+    if (written[0] != written[2])
+      throw std::runtime_error("PipelineWorker output differs from DirectWorker");
+
+    const Strategy::SmartMergeStrat::Stats st = smart.stats();
+    std::cout << "SmartMerge: labels=" << st.labels
+              << " bound=" << st.lowerBound << " blocks=" << st.blocks
+              << " earlyExits=" << st.earlyExits
+              << " skipped=" << st.skipped << "\n";
     std::cout << "[OK] Strategy print test complete.\n";
     return 0;
   } catch (const std::exception& ex) {